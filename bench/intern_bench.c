@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define LOOKUPS 1000000
+
+static uint32_t hash_bytes(const char *chars, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint32_t)(unsigned char)chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static double seconds_since(clock_t start) {
+    return (double)(clock() - start) / (double)CLOCKS_PER_SEC;
+}
+
+static void bench_population(size_t population) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_gc(&vm, 2.0, SIZE_MAX);
+    vm_configure_nursery(&vm, 0);
+
+    char buffer[32];
+    clock_t start = clock();
+    for (size_t i = 0; i < population; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "key-%zu", i);
+        obj_string_copy(&vm, buffer, (size_t)length);
+    }
+    double intern_seconds = seconds_since(start);
+
+    size_t found = 0;
+    uint64_t state = 88172645463325252ull;
+    start = clock();
+    for (size_t i = 0; i < LOOKUPS; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int length = snprintf(buffer, sizeof(buffer), "key-%zu", (size_t)(state % population));
+        if (table_find_string(&vm.strings, buffer, (size_t)length, hash_bytes(buffer, (size_t)length))) {
+            found++;
+        }
+    }
+    double lookup_seconds = seconds_since(start);
+
+    printf("%9zu strings: intern %7.1f ns/op, lookup %7.1f ns/op (%zu/%d hits)\n",
+           population,
+           intern_seconds * 1e9 / (double)population,
+           lookup_seconds * 1e9 / (double)LOOKUPS,
+           found,
+           LOOKUPS);
+    vm_free(&vm);
+}
+
+int main(void) {
+    size_t populations[] = {1000, 10000, 100000, 1000000};
+    for (size_t i = 0; i < sizeof(populations) / sizeof(populations[0]); ++i) {
+        bench_population(populations[i]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+
+#define ROUNDS 5
+
+static const char *UNIT =
+    "class Point%d {\n"
+    "  constructor(x, y) {\n"
+    "    this.x = x;\n"
+    "    this.y = y;\n"
+    "  }\n"
+    "  length(scale) {\n"
+    "    return (this.x * this.x + this.y * this.y) * scale;\n"
+    "  }\n"
+    "}\n"
+    "function step%d(n, label) {\n"
+    "  let total = 0;\n"
+    "  let items = [1, 2.5, \"three\", true, null];\n"
+    "  while (total < n) {\n"
+    "    if (total != -1) {\n"
+    "      total = total + 1;\n"
+    "    } else {\n"
+    "      items += [label + \"\\n\"];\n"
+    "    }\n"
+    "  }\n"
+    "  return Point%d(total, n).length(2);\n"
+    "}\n";
+
+static char *build_source(size_t target_size) {
+    size_t capacity = target_size + 4096;
+    char *source = (char *)malloc(capacity);
+    if (!source) {
+        fprintf(stderr, "Out of memory while building benchmark source.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t length = 0;
+    for (int i = 0; length < target_size; ++i) {
+        length += (size_t)snprintf(source + length, capacity - length, UNIT, i, i, i);
+    }
+    return source;
+}
+
+static double seconds_since(clock_t start) {
+    return (double)(clock() - start) / (double)CLOCKS_PER_SEC;
+}
+
+int main(void) {
+    size_t sizes[] = {1u << 20, 8u << 20};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        char *source = build_source(sizes[i]);
+        size_t length = strlen(source);
+        double best = 1e9;
+        for (int round = 0; round < ROUNDS; ++round) {
+            char *error = NULL;
+            clock_t start = clock();
+            Program *program = parser_parse(source, &error);
+            program_free(program);
+            double elapsed = seconds_since(start);
+            if (!program) {
+                fprintf(stderr, "parse failed: %s\n", error ? error : "unknown error");
+                free(error);
+                free(source);
+                return EXIT_FAILURE;
+            }
+            best = elapsed < best ? elapsed : best;
+        }
+        printf("%6.1f MiB source: parse+free %7.1f ms (%6.1f MiB/s)\n",
+               (double)length / (1024.0 * 1024.0),
+               best * 1e3,
+               (double)length / (1024.0 * 1024.0) / best);
+        free(source);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t capacity;
+    unsigned char data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+/* Blocks come from calloc and are never reused, so every allocation starts zeroed. */
+static ArenaBlock *new_block(Arena *arena, size_t minimum) {
+    size_t capacity = minimum > ARENA_BLOCK_SIZE ? minimum : ARENA_BLOCK_SIZE;
+    ArenaBlock *block = (ArenaBlock *)calloc(1, sizeof(ArenaBlock) + ARENA_ALIGNMENT + capacity);
+    if (!block) {
+        fprintf(stderr, "Out of memory while growing arena.\n");
+        exit(EXIT_FAILURE);
+    }
+    uintptr_t data = (uintptr_t)block->data;
+    block->used = align_up(data) - data;
+    block->capacity = block->used + capacity;
+    block->next = arena->head;
+    arena->head = block;
+    return block;
+}
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size == 0 ? 1 : size);
+    ArenaBlock *block = arena->head;
+    if (!block || block->capacity - block->used < size) {
+        block = new_block(arena, size);
+    }
+    void *pointer = block->data + block->used;
+    block->used += size;
+    return pointer;
+}
+
+void *arena_grow(Arena *arena, void *pointer, size_t old_size, size_t new_size) {
+    if (!pointer) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return pointer;
+    }
+    ArenaBlock *block = arena->head;
+    size_t old_aligned = align_up(old_size == 0 ? 1 : old_size);
+    size_t new_aligned = align_up(new_size);
+    if ((unsigned char *)pointer + old_aligned == block->data + block->used &&
+        new_aligned - old_aligned <= block->capacity - block->used) {
+        block->used += new_aligned - old_aligned;
+        return pointer;
+    }
+    void *moved = arena_alloc(arena, new_size);
+    memcpy(moved, pointer, old_size);
+    return moved;
+}
+
+char *arena_copy_string(Arena *arena, const char *chars, size_t length) {
+    char *copy = (char *)arena_alloc(arena, length + 1);
+    if (length > 0) {
+        memcpy(copy, chars, length);
+    }
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef VIBELANG_ARENA_H
+#define VIBELANG_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for data that shares one lifetime, such as a parsed AST.
+ * Allocations come back zeroed and aligned for any scalar type; individual
+ * allocations are never freed, arena_free releases everything at once.
+ */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+/* Resize `pointer`, extending it in place when it is the newest allocation. */
+void *arena_grow(Arena *arena, void *pointer, size_t old_size, size_t new_size);
+char *arena_copy_string(Arena *arena, const char *chars, size_t length);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bytecode.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "peephole.h"
+
+static const uint8_t BYTECODE_MAGIC[4] = {'V', 'I', 'B', 'C'};
+
+#define BYTECODE_NO_NAME UINT32_MAX
+#define BYTECODE_MAX_DEPTH 256
+/* Quiet NaNs carrying these bits are null, booleans or object pointers under NaN boxing. */
+#define BYTECODE_TAGGED_NAN ((uint64_t)0x7ffc000000000000)
+
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantTag;
+
+/* All multi-byte fields are little-endian regardless of the host. */
+typedef struct {
+    uint8_t *data;
+    size_t count;
+    size_t capacity;
+} Writer;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+} Reader;
+
+static void write_bytes(Writer *writer, const void *bytes, size_t length) {
+    if (writer->count + length > writer->capacity) {
+        size_t new_capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (new_capacity < writer->count + length) {
+            new_capacity *= 2;
+        }
+        uint8_t *data = (uint8_t *)realloc(writer->data, new_capacity);
+        if (!data) {
+            fprintf(stderr, "Out of memory while serialising bytecode.\n");
+            exit(EXIT_FAILURE);
+        }
+        writer->data = data;
+        writer->capacity = new_capacity;
+    }
+    if (length > 0) {
+        memcpy(writer->data + writer->count, bytes, length);
+    }
+    writer->count += length;
+}
+
+static void write_u32(Writer *writer, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    write_bytes(writer, bytes, sizeof(bytes));
+}
+
+static void write_u64(Writer *writer, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    write_bytes(writer, bytes, sizeof(bytes));
+}
+
+static void write_string(Writer *writer, const ObjString *string) {
+    if (!string) {
+        write_u32(writer, BYTECODE_NO_NAME);
+        return;
+    }
+    write_u32(writer, (uint32_t)string->length);
+    write_bytes(writer, string->chars, string->length);
+}
+
+static bool write_function(Writer *writer, const ObjFunction *function) {
+    const Chunk *chunk = &function->chunk;
+    write_u32(writer, (uint32_t)function->arity);
+    write_u32(writer, (uint32_t)function->register_count);
+    write_string(writer, function->name);
+
+    write_u32(writer, (uint32_t)chunk->count);
+    write_bytes(writer, chunk->code, (size_t)chunk->count);
+    write_u32(writer, (uint32_t)chunk->line_count);
+    for (int i = 0; i < chunk->line_count; ++i) {
+        write_u32(writer, (uint32_t)chunk->lines[i].offset);
+        write_u32(writer, (uint32_t)chunk->lines[i].line);
+    }
+    write_u32(writer, (uint32_t)chunk->cache_count);
+
+    write_u32(writer, (uint32_t)chunk->constants.count);
+    for (size_t i = 0; i < chunk->constants.count; ++i) {
+        Value constant = chunk->constants.values[i];
+        if (value_is_number(constant)) {
+            double number = value_as_number(constant);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            write_u32(writer, CONSTANT_NUMBER);
+            write_u64(writer, bits);
+        } else if (value_is_string(constant)) {
+            write_u32(writer, CONSTANT_STRING);
+            write_string(writer, value_as_string(constant));
+        } else if (value_is_function(constant)) {
+            write_u32(writer, CONSTANT_FUNCTION);
+            if (!write_function(writer, value_as_function(constant))) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_bytes(Reader *reader, size_t length, const uint8_t **bytes_out) {
+    if (length > reader->size - reader->offset) {
+        return false;
+    }
+    *bytes_out = reader->data + reader->offset;
+    reader->offset += length;
+    return true;
+}
+
+static bool read_u32(Reader *reader, uint32_t *value_out) {
+    const uint8_t *bytes;
+    if (!read_bytes(reader, 4, &bytes)) {
+        return false;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= (uint32_t)bytes[i] << (8 * i);
+    }
+    *value_out = value;
+    return true;
+}
+
+static bool read_u64(Reader *reader, uint64_t *value_out) {
+    const uint8_t *bytes;
+    if (!read_bytes(reader, 8, &bytes)) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    *value_out = value;
+    return true;
+}
+
+static bool read_string(Reader *reader, VM *vm, ObjString **string_out) {
+    uint32_t length;
+    if (!read_u32(reader, &length)) {
+        return false;
+    }
+    if (length == BYTECODE_NO_NAME) {
+        *string_out = NULL;
+        return true;
+    }
+    const uint8_t *chars;
+    if (!read_bytes(reader, length, &chars)) {
+        return false;
+    }
+    *string_out = obj_string_copy(vm, (const char *)chars, length);
+    return *string_out != NULL;
+}
+
+static ObjFunction *read_function(Reader *reader, VM *vm, int depth);
+
+static bool read_chunk(Reader *reader, VM *vm, ObjFunction *owner, int depth) {
+    Chunk *chunk = &owner->chunk;
+    uint32_t code_count;
+    const uint8_t *code;
+    if (!read_u32(reader, &code_count) || code_count > INT32_MAX || !read_bytes(reader, code_count, &code)) {
+        return false;
+    }
+    if (code_count > 0) {
+        chunk->code = (uint8_t *)malloc(code_count);
+        if (!chunk->code) {
+            fprintf(stderr, "Out of memory while loading bytecode.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(chunk->code, code, code_count);
+        chunk->count = (int)code_count;
+        chunk->capacity = (int)code_count;
+    }
+
+    uint32_t line_count;
+    if (!read_u32(reader, &line_count) || line_count > code_count) {
+        return false;
+    }
+    if (line_count > 0) {
+        chunk->lines = (LineRun *)malloc((size_t)line_count * sizeof(LineRun));
+        if (!chunk->lines) {
+            fprintf(stderr, "Out of memory while loading bytecode.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->line_capacity = (int)line_count;
+    }
+    for (uint32_t i = 0; i < line_count; ++i) {
+        uint32_t offset;
+        uint32_t line;
+        if (!read_u32(reader, &offset) || !read_u32(reader, &line) || offset >= code_count ||
+            (i > 0 && offset <= (uint32_t)chunk->lines[i - 1].offset)) {
+            return false;
+        }
+        chunk->lines[i].offset = (int)offset;
+        chunk->lines[i].line = (int)line;
+        chunk->line_count++;
+    }
+
+    uint32_t cache_count;
+    if (!read_u32(reader, &cache_count) || cache_count > UINT16_MAX) {
+        return false;
+    }
+    for (uint32_t i = 0; i < cache_count; ++i) {
+        chunk_add_inline_cache(chunk);
+    }
+
+    uint32_t constant_count;
+    if (!read_u32(reader, &constant_count) || constant_count >= UINT16_MAX) {
+        return false;
+    }
+    for (uint32_t i = 0; i < constant_count; ++i) {
+        uint32_t tag;
+        if (!read_u32(reader, &tag)) {
+            return false;
+        }
+        Value constant;
+        if (tag == CONSTANT_NUMBER) {
+            uint64_t bits;
+            double number;
+            if (!read_u64(reader, &bits) || (bits & BYTECODE_TAGGED_NAN) == BYTECODE_TAGGED_NAN) {
+                return false;
+            }
+            memcpy(&number, &bits, sizeof(number));
+            constant = value_make_number(number);
+        } else if (tag == CONSTANT_STRING) {
+            ObjString *string;
+            if (!read_string(reader, vm, &string) || !string) {
+                return false;
+            }
+            constant = value_make_string(string);
+        } else if (tag == CONSTANT_FUNCTION) {
+            ObjFunction *function = read_function(reader, vm, depth + 1);
+            if (!function) {
+                return false;
+            }
+            constant = value_make_function(function);
+        } else {
+            return false;
+        }
+        /* Pools are written already deduplicated, so indices must line up. */
+        if (obj_function_add_constant(vm, owner, constant) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static ObjFunction *read_function(Reader *reader, VM *vm, int depth) {
+    uint32_t arity;
+    uint32_t register_count;
+    if (depth > BYTECODE_MAX_DEPTH || !read_u32(reader, &arity) || !read_u32(reader, &register_count) ||
+        arity > UINT8_MAX || register_count > UINT8_MAX + 1 || arity > register_count) {
+        return NULL;
+    }
+    ObjString *name;
+    if (!read_string(reader, vm, &name)) {
+        return NULL;
+    }
+    if (name) {
+        vm_push(vm, value_make_string(name));
+    }
+    ObjFunction *function = obj_function_new(vm, name ? name->chars : NULL, (int)arity);
+    if (name) {
+        vm_pop(vm);
+    }
+    function->register_count = (int)register_count;
+    vm_push(vm, value_make_function(function));
+    bool ok = read_chunk(reader, vm, function, depth) && peephole_verify(&function->chunk, function->register_count);
+    vm_pop(vm);
+    return ok ? function : NULL;
+}
+
+uint64_t bytecode_hash_source(const char *source, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint64_t)(unsigned char)source[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool bytecode_serialize(const ObjFunction *function, uint64_t source_hash, int64_t source_mtime, uint8_t **data_out,
+                        size_t *size_out) {
+    if (!function || !data_out || !size_out) {
+        return false;
+    }
+    Writer writer = {NULL, 0, 0};
+    write_bytes(&writer, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+    write_u32(&writer, BYTECODE_FORMAT_VERSION);
+    write_u64(&writer, source_hash);
+    write_u64(&writer, (uint64_t)source_mtime);
+    if (!write_function(&writer, function)) {
+        free(writer.data);
+        return false;
+    }
+    *data_out = writer.data;
+    *size_out = writer.count;
+    return true;
+}
+
+ObjFunction *bytecode_deserialize(VM *vm, const uint8_t *data, size_t size, uint64_t source_hash, int64_t source_mtime) {
+    if (!vm || !data) {
+        return NULL;
+    }
+    Reader reader = {data, size, 0};
+    const uint8_t *magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t mtime;
+    if (!read_bytes(&reader, sizeof(BYTECODE_MAGIC), &magic) || memcmp(magic, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) != 0 ||
+        !read_u32(&reader, &version) || version != BYTECODE_FORMAT_VERSION || !read_u64(&reader, &hash) ||
+        hash != source_hash || !read_u64(&reader, &mtime) || mtime != (uint64_t)source_mtime) {
+        return NULL;
+    }
+    ObjFunction *function = read_function(&reader, vm, 0);
+    if (!function || reader.offset != reader.size || function->arity != 0) {
+        return NULL;
+    }
+    return function;
+}
+
+bool bytecode_write_file(const char *path, const ObjFunction *function, uint64_t source_hash, int64_t source_mtime) {
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (!path || !bytecode_serialize(function, source_hash, source_mtime, &data, &size)) {
+        return false;
+    }
+    /* Write beside the target and rename so readers never see a partial file. */
+    size_t path_length = strlen(path);
+    char *temp_path = (char *)malloc(path_length + 5);
+    if (!temp_path) {
+        free(data);
+        return false;
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", 5);
+
+    FILE *file = fopen(temp_path, "wb");
+    bool ok = file != NULL;
+    if (file) {
+        ok = fwrite(data, 1, size, file) == size;
+        ok = fclose(file) == 0 && ok;
+    }
+    if (ok) {
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+    }
+    free(temp_path);
+    free(data);
+    return ok;
+}
+
+ObjFunction *bytecode_read_file(VM *vm, const char *path, uint64_t source_hash, int64_t source_mtime) {
+    if (!vm || !path) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    ObjFunction *function = bytecode_deserialize(vm, (const uint8_t *)mapping, size, source_hash, source_mtime);
+    munmap(mapping, size);
+    return function;
+}
@@ -0,0 +1,40 @@
+#ifndef VIBELANG_BYTECODE_H
+#define VIBELANG_BYTECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object.h"
+#include "vm.h"
+
+/*
+ * Binary image of a compiled script (.vibec). The header records the format
+ * version together with the hash and modification time of the source it was
+ * compiled from; a load only succeeds when all three match, so a stale or
+ * foreign cache is simply treated as a miss. Bump the version whenever the
+ * opcode set or an instruction encoding changes.
+ */
+#define BYTECODE_FORMAT_VERSION 6
+
+uint64_t bytecode_hash_source(const char *source, size_t length);
+
+/**
+ * Serialise `function` and every function reachable through its constants.
+ * On success, stores a malloc'd buffer the caller must free. Returns false if
+ * the tree holds a constant that cannot be serialised.
+ */
+bool bytecode_serialize(const ObjFunction *function, uint64_t source_hash, int64_t source_mtime, uint8_t **data_out,
+                        size_t *size_out);
+
+/**
+ * Rebuild a function tree from a serialised image. Returns NULL when the
+ * image is malformed or was produced for a different source or format.
+ */
+ObjFunction *bytecode_deserialize(VM *vm, const uint8_t *data, size_t size, uint64_t source_hash, int64_t source_mtime);
+
+/* File wrappers; the reader maps the cache with mmap instead of copying it. */
+bool bytecode_write_file(const char *path, const ObjFunction *function, uint64_t source_hash, int64_t source_mtime);
+ObjFunction *bytecode_read_file(VM *vm, const char *path, uint64_t source_hash, int64_t source_mtime);
+
+#endif
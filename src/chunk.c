@@ -1,9 +1,11 @@
 #include "chunk.h"
+#include "object.h"
 
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static int grow_capacity(int capacity) {
     return capacity < 8 ? 8 : capacity * 2;
@@ -21,26 +23,114 @@ static bool ensure_capacity(Chunk *chunk, int needed) {
     if (!code) {
         return false;
     }
-    int *lines = (int *)realloc(chunk->lines, (size_t)new_capacity * sizeof(int));
-    if (!lines) {
-        free(code);
-        return false;
-    }
     chunk->code = code;
-    chunk->lines = lines;
     chunk->capacity = new_capacity;
     return true;
 }
 
+static void add_line_run(Chunk *chunk, int offset, int line) {
+    if (chunk->line_count == chunk->line_capacity) {
+        int new_capacity = grow_capacity(chunk->line_capacity);
+        LineRun *lines = (LineRun *)realloc(chunk->lines, (size_t)new_capacity * sizeof(LineRun));
+        if (!lines) {
+            fprintf(stderr, "Out of memory while growing line table.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->lines = lines;
+        chunk->line_capacity = new_capacity;
+    }
+    chunk->lines[chunk->line_count].offset = offset;
+    chunk->lines[chunk->line_count].line = line;
+    chunk->line_count++;
+}
+
+/*
+ * Numbers are keyed by their bit pattern and strings by pointer, which is
+ * exact because every string constant is interned. Other constants (function
+ * prototypes) are unique per site and are never deduplicated.
+ */
+static bool constant_key(Value value, uint64_t *key_out) {
+    if (value_is_number(value)) {
+        double number = value_as_number(value);
+        memcpy(key_out, &number, sizeof(number));
+        return true;
+    }
+    if (value_is_string(value)) {
+        *key_out = (uint64_t)(uintptr_t)value_as_string(value);
+        return true;
+    }
+    return false;
+}
+
+static bool constant_matches(Value existing, Value value, uint64_t key) {
+    if (value_is_number(existing) != value_is_number(value)) {
+        return false;
+    }
+    uint64_t existing_key;
+    return constant_key(existing, &existing_key) && existing_key == key;
+}
+
+static uint32_t hash_constant_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static uint32_t *find_constant_slot(const Chunk *chunk, Value value, uint64_t key) {
+    uint32_t mask = (uint32_t)chunk->constant_index_capacity - 1;
+    uint32_t slot = hash_constant_key(key) & mask;
+    for (;;) {
+        uint32_t *entry = &chunk->constant_index[slot];
+        if (*entry == 0 || constant_matches(chunk->constants.values[*entry - 1], value, key)) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void grow_constant_index(Chunk *chunk) {
+    int new_capacity = grow_capacity(chunk->constant_index_capacity) * 2;
+    uint32_t *entries = (uint32_t *)calloc((size_t)new_capacity, sizeof(uint32_t));
+    if (!entries) {
+        fprintf(stderr, "Out of memory while growing constant index.\n");
+        exit(EXIT_FAILURE);
+    }
+    free(chunk->constant_index);
+    chunk->constant_index = entries;
+    chunk->constant_index_capacity = new_capacity;
+    chunk->constant_index_count = 0;
+    for (size_t i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        uint64_t key;
+        if (!constant_key(value, &key)) {
+            continue;
+        }
+        uint32_t *entry = find_constant_slot(chunk, value, key);
+        if (*entry == 0) {
+            *entry = (uint32_t)i + 1;
+            chunk->constant_index_count++;
+        }
+    }
+}
+
 void chunk_init(Chunk *chunk) {
     if (!chunk) {
         return;
     }
     chunk->code = NULL;
-    chunk->lines = NULL;
     chunk->count = 0;
     chunk->capacity = 0;
+    chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
     value_array_init(&chunk->constants);
+    chunk->constant_index = NULL;
+    chunk->constant_index_count = 0;
+    chunk->constant_index_capacity = 0;
+    chunk->caches = NULL;
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
 }
 
 void chunk_write(Chunk *chunk, uint8_t byte, int line) {
@@ -51,15 +141,29 @@ void chunk_write(Chunk *chunk, uint8_t byte, int line) {
         fprintf(stderr, "Out of memory while growing chunk.\n");
         exit(EXIT_FAILURE);
     }
+    if (chunk->line_count == 0 || chunk->lines[chunk->line_count - 1].line != line) {
+        add_line_run(chunk, chunk->count, line);
+    }
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
 }
 
+/* A function's own chunk takes constants through obj_function_add_constant, which adds the write barrier. */
 uint16_t chunk_add_constant(Chunk *chunk, Value value) {
     if (!chunk) {
         return UINT16_MAX;
     }
+    uint64_t key;
+    uint32_t *entry = NULL;
+    if (constant_key(value, &key)) {
+        if ((chunk->constant_index_count + 1) * 4 > chunk->constant_index_capacity * 3) {
+            grow_constant_index(chunk);
+        }
+        entry = find_constant_slot(chunk, value, key);
+        if (*entry != 0) {
+            return (uint16_t)(*entry - 1);
+        }
+    }
     if (!value_array_write(&chunk->constants, value)) {
         fprintf(stderr, "Out of memory while adding constant.\n");
         exit(EXIT_FAILURE);
@@ -68,6 +172,10 @@ uint16_t chunk_add_constant(Chunk *chunk, Value value) {
         fprintf(stderr, "Too many constants in chunk.\n");
         exit(EXIT_FAILURE);
     }
+    if (entry) {
+        *entry = (uint32_t)chunk->constants.count;
+        chunk->constant_index_count++;
+    }
     return (uint16_t)(chunk->constants.count - 1);
 }
 
@@ -79,6 +187,45 @@ Value chunk_get_constant(const Chunk *chunk, uint16_t index) {
     return chunk->constants.values[index];
 }
 
+uint16_t chunk_add_inline_cache(Chunk *chunk) {
+    if (!chunk) {
+        return UINT16_MAX;
+    }
+    if (chunk->cache_count >= UINT16_MAX) {
+        fprintf(stderr, "Too many inline caches in chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (chunk->cache_count == chunk->cache_capacity) {
+        int new_capacity = grow_capacity(chunk->cache_capacity);
+        InlineCache *caches = (InlineCache *)realloc(chunk->caches, (size_t)new_capacity * sizeof(InlineCache));
+        if (!caches) {
+            fprintf(stderr, "Out of memory while adding inline cache.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->caches = caches;
+        chunk->cache_capacity = new_capacity;
+    }
+    memset(&chunk->caches[chunk->cache_count], 0, sizeof(InlineCache));
+    return (uint16_t)chunk->cache_count++;
+}
+
+int chunk_get_line(const Chunk *chunk, int offset) {
+    if (!chunk || chunk->line_count == 0 || offset < 0 || offset >= chunk->count) {
+        return 0;
+    }
+    int low = 0;
+    int high = chunk->line_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return chunk->lines[low].line;
+}
+
 void chunk_free(Chunk *chunk) {
     if (!chunk) {
         return;
@@ -86,8 +233,18 @@ void chunk_free(Chunk *chunk) {
     free(chunk->code);
     free(chunk->lines);
     chunk->code = NULL;
-    chunk->lines = NULL;
     chunk->count = 0;
     chunk->capacity = 0;
+    chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
     value_array_free(&chunk->constants);
+    free(chunk->constant_index);
+    chunk->constant_index = NULL;
+    chunk->constant_index_count = 0;
+    chunk->constant_index_capacity = 0;
+    free(chunk->caches);
+    chunk->caches = NULL;
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
 }
@@ -20,12 +20,40 @@ typedef enum {
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    /* `op dest, a, k`: binary ops whose right operand is constant k (16-bit index). */
+    OP_ADD_K,
+    OP_SUBTRACT_K,
+    OP_MULTIPLY_K,
+    OP_DIVIDE_K,
+    OP_EQUAL_K,
+    OP_GREATER_K,
+    OP_LESS_K,
+    OP_APPEND_K,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
+    /*
+     * Fused compare-and-branch: `op a, b, offset` jumps forward when the test
+     * holds. LE and GE are the negations of GT and LT, matching how `<=` and
+     * `>=` evaluate. The _K forms read b from the constant pool (16-bit index).
+     */
+    OP_JUMP_IF_LT,
+    OP_JUMP_IF_LE,
+    OP_JUMP_IF_GT,
+    OP_JUMP_IF_GE,
+    OP_JUMP_IF_EQ,
+    OP_JUMP_IF_NE,
+    OP_JUMP_IF_LT_K,
+    OP_JUMP_IF_LE_K,
+    OP_JUMP_IF_GT_K,
+    OP_JUMP_IF_GE_K,
+    OP_JUMP_IF_EQ_K,
+    OP_JUMP_IF_NE_K,
     OP_LOOP,
     OP_CALL,
     OP_BUILD_ARRAY,
     OP_ARRAY_GET,
+    OP_APPEND,
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
     OP_CLASS,
@@ -34,21 +62,72 @@ typedef enum {
     OP_RETURN,
     OP_GET_GLOBAL,
     OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL
+    OP_SET_GLOBAL,
+    /* Quickened forms: never emitted by the compiler, only patched in by the VM. */
+    OP_ADD_NUM,
+    OP_APPEND_NUM,
+    OP_EQUAL_NUM
 } OpCode;
 
+#define INLINE_CACHE_ENTRIES 4
+
+typedef enum {
+    IC_EMPTY,
+    IC_FIELD,
+    IC_TRANSITION,
+    IC_METHOD,
+    IC_CLASS_METHOD
+} InlineCacheKind;
+
+/*
+ * One resolved lookup. Instance entries are keyed by the receiver's shape
+ * (and, for methods, its class); class entries have no shape. `index` is a
+ * slot index for fields/transitions and an index into the class's method
+ * table otherwise.
+ */
+typedef struct {
+    InlineCacheKind kind;
+    uint32_t index;
+    const struct Shape *shape;
+    struct ObjClass *klass;
+    struct Shape *transition;
+} InlineCacheEntry;
+
+/* Per-instruction cache used by OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE. */
+typedef struct {
+    InlineCacheEntry entries[INLINE_CACHE_ENTRIES];
+    uint8_t next_victim;
+} InlineCache;
+
+/* Source line shared by every byte from `offset` up to the next run. */
+typedef struct {
+    int offset;
+    int line;
+} LineRun;
+
 typedef struct {
     uint8_t *code;
-    int *lines;
     int count;
     int capacity;
+    LineRun *lines;
+    int line_count;
+    int line_capacity;
     ValueArray constants;
+    /* Open-addressed map from number/string constants to index + 1 (0 = empty). */
+    uint32_t *constant_index;
+    int constant_index_count;
+    int constant_index_capacity;
+    InlineCache *caches;
+    int cache_count;
+    int cache_capacity;
 } Chunk;
 
 void chunk_init(Chunk *chunk);
 void chunk_write(Chunk *chunk, uint8_t byte, int line);
 uint16_t chunk_add_constant(Chunk *chunk, Value value);
 Value chunk_get_constant(const Chunk *chunk, uint16_t index);
+uint16_t chunk_add_inline_cache(Chunk *chunk);
+int chunk_get_line(const Chunk *chunk, int offset);
 void chunk_free(Chunk *chunk);
 
 #endif
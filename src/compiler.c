@@ -8,6 +8,8 @@
 #include <string.h>
 #include <limits.h>
 
+#include "fold.h"
+#include "peephole.h"
 #include "object.h"
 #include "value.h"
 
@@ -76,6 +78,7 @@ struct Compiler {
     bool pending_has_value;
     RegisterResult pending_value;
     FunctionType type;
+    int line;
 };
 
 static void compiler_errorf(char **error_message, const char *format, ...);
@@ -86,6 +89,9 @@ static bool global_table_add(GlobalTable *table, const char *name, uint16_t *ind
 static void compiler_init(Compiler *compiler, Compilation *compilation, Compiler *enclosing, ObjFunction *function, const Program *program, FunctionType type);
 static bool compile_statement(Compiler *compiler, const Statement *statement, char **error_message);
 static bool compile_expression(Compiler *compiler, const Expression *expression, char **error_message);
+static bool compile_expression_node(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                                    char **error_message);
+static bool compile_statement_node(Compiler *compiler, const Statement *statement, char **error_message);
 static Chunk *current_chunk(Compiler *compiler);
 static void emit_byte(Compiler *compiler, uint8_t byte);
 static bool patch_jump(Compiler *compiler, int offset, char **error_message);
@@ -101,10 +107,13 @@ static bool compile_if_statement(Compiler *compiler, const Statement *statement,
 static bool compile_while_statement(Compiler *compiler, const Statement *statement, char **error_message);
 static bool compile_function_statement(Compiler *compiler, const Statement *statement, char **error_message);
 static bool compile_return_statement(Compiler *compiler, const Statement *statement, char **error_message);
-static bool compile_assignment(Compiler *compiler, const Expression *expression, char **error_message);
-static bool compile_call(Compiler *compiler, const Expression *expression, char **error_message);
-static bool compile_array_literal(Compiler *compiler, const Expression *expression, char **error_message);
-static bool compile_index_expression(Compiler *compiler, const Expression *expression, char **error_message);
+static bool compile_assignment(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message);
+static bool compile_call(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message);
+static bool compile_array_literal(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message);
+static bool compile_index_expression(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                                     char **error_message);
+static bool compile_operand_list(Compiler *compiler, const ExpressionList *list, uint8_t *registers, int *temps,
+                                 char **error_message);
 static bool compile_class_statement(Compiler *compiler, const Statement *statement, char **error_message);
 static bool compile_method(Compiler *compiler, const ClassMethod *method, int class_reg, char **error_message);
 static void discard_pending_expression(Compiler *compiler);
@@ -200,6 +209,10 @@ static Chunk *current_chunk(Compiler *compiler) {
     return &compiler->function->chunk;
 }
 
+static uint16_t add_constant(Compiler *compiler, Value value) {
+    return obj_function_add_constant(compiler->vm, compiler->function, value);
+}
+
 static void compiler_init(Compiler *compiler, Compilation *compilation, Compiler *enclosing, ObjFunction *function, const Program *program, FunctionType type) {
     compiler->vm = compilation->vm;
     compiler->program = program;
@@ -213,12 +226,13 @@ static void compiler_init(Compiler *compiler, Compilation *compilation, Compiler
     compiler->stack_depth = 0;
     compiler->pending_has_value = false;
     compiler->pending_value = register_result_invalid();
+    compiler->line = enclosing ? enclosing->line : 1;
     compiler->function->register_count = 0;
     compiler->type = type;
 }
 
 static void emit_byte(Compiler *compiler, uint8_t byte) {
-    chunk_write(current_chunk(compiler), byte, 0);
+    chunk_write(current_chunk(compiler), byte, compiler->line);
 }
 
 static bool update_register_usage(Compiler *compiler, char **error_message) {
@@ -264,13 +278,16 @@ static void pop_stack_slots(Compiler *compiler, int count) {
     }
 }
 
-static bool emit_op_load_constant(Compiler *compiler, int dest, Value value, char **error_message) {
-    Chunk *chunk = current_chunk(compiler);
-    uint16_t index = chunk_add_constant(chunk, value);
+static void emit_op_load_constant_index(Compiler *compiler, int dest, uint16_t index) {
     emit_byte(compiler, OP_LOAD_CONST);
     emit_byte(compiler, (uint8_t)dest);
     emit_byte(compiler, (uint8_t)((index >> 8) & 0xFF));
     emit_byte(compiler, (uint8_t)(index & 0xFF));
+}
+
+static bool emit_op_load_constant(Compiler *compiler, int dest, Value value, char **error_message) {
+    uint16_t index = add_constant(compiler, value);
+    emit_op_load_constant_index(compiler, dest, index);
     (void)error_message;
     return true;
 }
@@ -304,6 +321,14 @@ static void emit_op_binary(Compiler *compiler, OpCode opcode, int dest, int left
     emit_byte(compiler, (uint8_t)right);
 }
 
+static void emit_op_binary_constant(Compiler *compiler, OpCode opcode, int dest, int left, uint16_t constant_index) {
+    emit_byte(compiler, opcode);
+    emit_byte(compiler, (uint8_t)dest);
+    emit_byte(compiler, (uint8_t)left);
+    emit_byte(compiler, (uint8_t)((constant_index >> 8) & 0xFF));
+    emit_byte(compiler, (uint8_t)(constant_index & 0xFF));
+}
+
 static void emit_op_get_global(Compiler *compiler, int dest, uint16_t slot) {
     emit_byte(compiler, OP_GET_GLOBAL);
     emit_byte(compiler, (uint8_t)dest);
@@ -359,7 +384,7 @@ static bool make_string_constant(Compiler *compiler, const char *text, uint16_t
     }
     Value value = value_make_string(string);
     vm_push(compiler->vm, value);
-    uint16_t index = chunk_add_constant(current_chunk(compiler), value);
+    uint16_t index = add_constant(compiler, value);
     vm_pop(compiler->vm);
     if (index_out) {
         *index_out = index;
@@ -382,12 +407,19 @@ static void emit_op_method(Compiler *compiler, int class_reg, uint16_t name_inde
     emit_byte(compiler, (uint8_t)method_reg);
 }
 
+static void emit_inline_cache(Compiler *compiler) {
+    uint16_t cache_index = chunk_add_inline_cache(current_chunk(compiler));
+    emit_byte(compiler, (uint8_t)((cache_index >> 8) & 0xFF));
+    emit_byte(compiler, (uint8_t)(cache_index & 0xFF));
+}
+
 static void emit_op_get_property(Compiler *compiler, int dest, int object_reg, uint16_t name_index) {
     emit_byte(compiler, OP_GET_PROPERTY);
     emit_byte(compiler, (uint8_t)dest);
     emit_byte(compiler, (uint8_t)object_reg);
     emit_byte(compiler, (uint8_t)((name_index >> 8) & 0xFF));
     emit_byte(compiler, (uint8_t)(name_index & 0xFF));
+    emit_inline_cache(compiler);
 }
 
 static void emit_op_set_property(Compiler *compiler, int object_reg, uint16_t name_index, int value_reg) {
@@ -396,6 +428,7 @@ static void emit_op_set_property(Compiler *compiler, int object_reg, uint16_t na
     emit_byte(compiler, (uint8_t)((name_index >> 8) & 0xFF));
     emit_byte(compiler, (uint8_t)(name_index & 0xFF));
     emit_byte(compiler, (uint8_t)value_reg);
+    emit_inline_cache(compiler);
 }
 
 static void emit_op_invoke(Compiler *compiler, int dest, int object_reg, uint16_t name_index, uint8_t arg_count, const uint8_t *args) {
@@ -404,6 +437,7 @@ static void emit_op_invoke(Compiler *compiler, int dest, int object_reg, uint16_
     emit_byte(compiler, (uint8_t)object_reg);
     emit_byte(compiler, (uint8_t)((name_index >> 8) & 0xFF));
     emit_byte(compiler, (uint8_t)(name_index & 0xFF));
+    emit_inline_cache(compiler);
     emit_byte(compiler, arg_count);
     for (uint8_t i = 0; i < arg_count; ++i) {
         emit_byte(compiler, args[i]);
@@ -425,6 +459,25 @@ static int emit_jump_if_false(Compiler *compiler, int condition_reg) {
     return current_chunk(compiler)->count - 2;
 }
 
+static int emit_jump_compare(Compiler *compiler, OpCode opcode, int left_reg, int right_reg) {
+    emit_byte(compiler, opcode);
+    emit_byte(compiler, (uint8_t)left_reg);
+    emit_byte(compiler, (uint8_t)right_reg);
+    emit_byte(compiler, 0xFF);
+    emit_byte(compiler, 0xFF);
+    return current_chunk(compiler)->count - 2;
+}
+
+static int emit_jump_compare_constant(Compiler *compiler, OpCode opcode, int left_reg, uint16_t index) {
+    emit_byte(compiler, opcode);
+    emit_byte(compiler, (uint8_t)left_reg);
+    emit_byte(compiler, (uint8_t)((index >> 8) & 0xFF));
+    emit_byte(compiler, (uint8_t)(index & 0xFF));
+    emit_byte(compiler, 0xFF);
+    emit_byte(compiler, 0xFF);
+    return current_chunk(compiler)->count - 2;
+}
+
 static bool patch_jump(Compiler *compiler, int offset, char **error_message) {
     Chunk *chunk = current_chunk(compiler);
     int jump = chunk->count - offset - 2;
@@ -530,6 +583,410 @@ static int resolve_local(Compiler *compiler, const char *name, bool for_assignme
     return -1;
 }
 
+/* `k < x` is `x > k`; the swap keeps `<=`/`>=` defined as negated `>`/`<`. */
+static TokenType swapped_comparison(TokenType operator_type) {
+    switch (operator_type) {
+        case TOKEN_LESS:
+            return TOKEN_GREATER;
+        case TOKEN_LESS_EQUAL:
+            return TOKEN_GREATER_EQUAL;
+        case TOKEN_GREATER:
+            return TOKEN_LESS;
+        case TOKEN_GREATER_EQUAL:
+            return TOKEN_LESS_EQUAL;
+        default:
+            return operator_type;
+    }
+}
+
+/* Maps a binary operator to its opcode; `>=`, `<=` and `!=` negate the result. */
+static bool binary_opcode(TokenType operator_type, OpCode *opcode_out, bool *negate_out) {
+    *negate_out = false;
+    switch (operator_type) {
+        case TOKEN_PLUS:
+            *opcode_out = OP_ADD;
+            return true;
+        case TOKEN_MINUS:
+            *opcode_out = OP_SUBTRACT;
+            return true;
+        case TOKEN_STAR:
+            *opcode_out = OP_MULTIPLY;
+            return true;
+        case TOKEN_SLASH:
+            *opcode_out = OP_DIVIDE;
+            return true;
+        case TOKEN_GREATER:
+            *opcode_out = OP_GREATER;
+            return true;
+        case TOKEN_GREATER_EQUAL:
+            *opcode_out = OP_LESS;
+            *negate_out = true;
+            return true;
+        case TOKEN_LESS:
+            *opcode_out = OP_LESS;
+            return true;
+        case TOKEN_LESS_EQUAL:
+            *opcode_out = OP_GREATER;
+            *negate_out = true;
+            return true;
+        case TOKEN_EQUAL_EQUAL:
+            *opcode_out = OP_EQUAL;
+            return true;
+        case TOKEN_BANG_EQUAL:
+            *opcode_out = OP_EQUAL;
+            *negate_out = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static OpCode constant_operand_opcode(OpCode opcode) {
+    switch (opcode) {
+        case OP_ADD:
+            return OP_ADD_K;
+        case OP_SUBTRACT:
+            return OP_SUBTRACT_K;
+        case OP_MULTIPLY:
+            return OP_MULTIPLY_K;
+        case OP_DIVIDE:
+            return OP_DIVIDE_K;
+        case OP_GREATER:
+            return OP_GREATER_K;
+        case OP_LESS:
+            return OP_LESS_K;
+        default:
+            return OP_EQUAL_K;
+    }
+}
+
+static bool is_comparison(TokenType operator_type) {
+    switch (operator_type) {
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL:
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_BANG_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool add_folded_constant(Compiler *compiler, const FoldedValue *folded, uint16_t *index_out, char **error_message) {
+    if (folded->kind == FOLD_NUMBER) {
+        *index_out = add_constant(compiler, value_make_number(folded->number));
+        return true;
+    }
+    ObjString *string = obj_string_copy(compiler->vm, folded->chars, folded->length);
+    if (!string) {
+        compiler_errorf(error_message, "Out of memory while creating string constant.");
+        return false;
+    }
+    Value value = value_make_string(string);
+    vm_push(compiler->vm, value);
+    *index_out = add_constant(compiler, value);
+    vm_pop(compiler->vm);
+    return true;
+}
+
+/* Operands that binary operators read straight from the constant pool: anything folding to a number or string. */
+static bool fold_operand(const Expression *expression, FoldedValue *out) {
+    if (!fold_expression(expression, out)) {
+        return false;
+    }
+    if (out->kind == FOLD_NUMBER || out->kind == FOLD_STRING) {
+        return true;
+    }
+    folded_value_free(out);
+    return false;
+}
+
+static bool is_folded_constant(const Expression *expression) {
+    FoldedValue folded;
+    if (!fold_expression(expression, &folded)) {
+        return false;
+    }
+    folded_value_free(&folded);
+    return true;
+}
+
+static bool is_constant_operand(const Expression *expression) {
+    FoldedValue folded;
+    if (!fold_operand(expression, &folded)) {
+        return false;
+    }
+    folded_value_free(&folded);
+    return true;
+}
+
+static bool add_operand_constant(Compiler *compiler, const Expression *expression, uint16_t *index_out, char **error_message) {
+    FoldedValue folded;
+    if (!fold_operand(expression, &folded)) {
+        compiler_errorf(error_message, "Operand is not a constant.");
+        return false;
+    }
+    bool ok = add_folded_constant(compiler, &folded, index_out, error_message);
+    folded_value_free(&folded);
+    return ok;
+}
+
+/* Load a value computed at compile time into `target`, or a new temporary when it is -1. */
+static bool compile_folded(Compiler *compiler, const FoldedValue *folded, int target, RegisterResult *result,
+                           char **error_message) {
+    int dest = target;
+    if (dest < 0 && !push_stack_slot(compiler, error_message, &dest)) {
+        return false;
+    }
+    *result = register_result_make(dest, target < 0);
+    switch (folded->kind) {
+        case FOLD_NULL:
+            emit_op_load_null(compiler, dest);
+            return true;
+        case FOLD_BOOL:
+            emit_op_load_bool(compiler, dest, folded->boolean);
+            return true;
+        case FOLD_NUMBER:
+        case FOLD_STRING: {
+            uint16_t index = 0;
+            if (!add_folded_constant(compiler, folded, &index, error_message)) {
+                return false;
+            }
+            emit_op_load_constant_index(compiler, dest, index);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool list_assigns(const ExpressionList *list, size_t from);
+
+/*
+ * Whether evaluating `expression` can assign a variable. Operands that live in
+ * a local's register are only read when the consuming instruction runs, so
+ * they must be copied first if anything evaluated in between may assign.
+ */
+static bool expression_assigns(const Expression *expression) {
+    switch (expression->type) {
+        case EXPR_ASSIGNMENT:
+            return true;
+        case EXPR_UNARY:
+            return expression_assigns(expression->as.unary.right);
+        case EXPR_BINARY:
+            return expression_assigns(expression->as.binary.left) || expression_assigns(expression->as.binary.right);
+        case EXPR_CALL:
+            return expression_assigns(expression->as.call.callee) || list_assigns(&expression->as.call.arguments, 0);
+        case EXPR_ARRAY:
+            return list_assigns(&expression->as.array_literal.elements, 0);
+        case EXPR_INDEX:
+            return expression_assigns(expression->as.index.array) || expression_assigns(expression->as.index.index);
+        case EXPR_GET_PROPERTY:
+            return expression_assigns(expression->as.get_property.object);
+        case EXPR_SET_PROPERTY:
+            return expression_assigns(expression->as.set_property.object) ||
+                   expression_assigns(expression->as.set_property.value);
+        case EXPR_INVOKE:
+            return expression_assigns(expression->as.invoke.object) || list_assigns(&expression->as.invoke.arguments, 0);
+        default:
+            return false;
+    }
+}
+
+static bool list_assigns(const ExpressionList *list, size_t from) {
+    for (size_t i = from; i < list->count; ++i) {
+        if (expression_assigns(list->items[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool compile_operand(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message) {
+    int enclosing_line = compiler->line;
+    if (expression) {
+        compiler->line = expression->line;
+    }
+    bool ok = compile_expression_node(compiler, expression, -1, result, error_message);
+    compiler->line = enclosing_line;
+    return ok;
+}
+
+/* compile_operand, but copied into a temporary now when `copy` is set. */
+static bool compile_operand_before(Compiler *compiler, const Expression *expression, bool copy, RegisterResult *result,
+                                   char **error_message) {
+    if (!copy) {
+        return compile_operand(compiler, expression, result, error_message);
+    }
+    if (!compile_expression(compiler, expression, error_message)) {
+        return false;
+    }
+    *result = register_result_make(stack_top_register(compiler, 0), true);
+    return true;
+}
+
+/* Evaluate into a fresh temporary on top of the stack. */
+static bool compile_expression(Compiler *compiler, const Expression *expression, char **error_message) {
+    int enclosing_line = compiler->line;
+    if (expression) {
+        compiler->line = expression->line;
+    }
+    RegisterResult result;
+    bool ok = compile_expression_node(compiler, expression, -1, &result, error_message);
+    if (ok && !result.is_temp) {
+        int dest = 0;
+        ok = push_stack_slot(compiler, error_message, &dest);
+        if (ok) {
+            emit_op_move(compiler, dest, result.reg);
+        }
+    }
+    compiler->line = enclosing_line;
+    return ok;
+}
+
+/* Evaluate straight into `target`, copying only when the value was produced elsewhere. */
+static bool compile_expression_into(Compiler *compiler, const Expression *expression, int target, char **error_message) {
+    int enclosing_line = compiler->line;
+    if (expression) {
+        compiler->line = expression->line;
+    }
+    RegisterResult result;
+    bool ok = compile_expression_node(compiler, expression, target, &result, error_message);
+    if (ok && result.reg != target) {
+        emit_op_move(compiler, target, result.reg);
+    }
+    if (ok && result.is_temp) {
+        pop_stack_slots(compiler, 1);
+    }
+    compiler->line = enclosing_line;
+    return ok;
+}
+
+/*
+ * Choose where an instruction reading `operands` writes its result: `target`
+ * when given, else the lowest temporary among the operands, else a new one.
+ * Every other temporary is released.
+ */
+static bool claim_result(Compiler *compiler, const RegisterResult *operands, int count, int target, RegisterResult *result,
+                         char **error_message) {
+    int temps = 0;
+    int lowest = -1;
+    for (int i = 0; i < count; ++i) {
+        if (operands[i].is_temp) {
+            if (lowest < 0) {
+                lowest = operands[i].reg;
+            }
+            temps++;
+        }
+    }
+    if (target >= 0) {
+        pop_stack_slots(compiler, temps);
+        *result = register_result_make(target, false);
+        return true;
+    }
+    if (temps == 0) {
+        int dest = 0;
+        if (!push_stack_slot(compiler, error_message, &dest)) {
+            return false;
+        }
+        *result = register_result_make(dest, true);
+        return true;
+    }
+    pop_stack_slots(compiler, temps - 1);
+    *result = register_result_make(lowest, true);
+    return true;
+}
+
+static void release_operand(Compiler *compiler, RegisterResult operand) {
+    if (operand.is_temp) {
+        pop_stack_slots(compiler, 1);
+    }
+}
+
+static bool compile_binary(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                           char **error_message) {
+    TokenType operator_type = expression->as.binary.operator_type;
+    const Expression *left = expression->as.binary.left;
+    const Expression *right = expression->as.binary.right;
+    /* Only comparisons commute; `1 + x` may be string or array addition. */
+    if (is_comparison(operator_type) && is_constant_operand(left) && !is_constant_operand(right)) {
+        operator_type = swapped_comparison(operator_type);
+        left = expression->as.binary.right;
+        right = expression->as.binary.left;
+    }
+    OpCode opcode = OP_ADD;
+    bool negate = false;
+    if (!binary_opcode(operator_type, &opcode, &negate)) {
+        compiler_errorf(error_message, "Unsupported binary operator.");
+        return false;
+    }
+    bool constant_right = is_constant_operand(right);
+    RegisterResult operands[2];
+    if (!compile_operand_before(compiler, left, !constant_right && expression_assigns(right), &operands[0], error_message)) {
+        return false;
+    }
+    uint16_t index = 0;
+    if (constant_right) {
+        if (!add_operand_constant(compiler, right, &index, error_message)) {
+            return false;
+        }
+    } else if (!compile_operand(compiler, right, &operands[1], error_message)) {
+        return false;
+    }
+    if (!claim_result(compiler, operands, constant_right ? 1 : 2, target, result, error_message)) {
+        return false;
+    }
+    if (constant_right) {
+        emit_op_binary_constant(compiler, constant_operand_opcode(opcode), result->reg, operands[0].reg, index);
+    } else {
+        emit_op_binary(compiler, opcode, result->reg, operands[0].reg, operands[1].reg);
+    }
+    if (negate) {
+        emit_op_unary(compiler, OP_NOT, result->reg, result->reg);
+    }
+    return true;
+}
+
+static bool compile_unary(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                          char **error_message) {
+    OpCode opcode;
+    switch (expression->as.unary.operator_type) {
+        case TOKEN_MINUS:
+            opcode = OP_NEGATE;
+            break;
+        case TOKEN_BANG:
+            opcode = OP_NOT;
+            break;
+        default:
+            compiler_errorf(error_message, "Unsupported unary operator.");
+            return false;
+    }
+    RegisterResult operand;
+    if (!compile_operand(compiler, expression->as.unary.right, &operand, error_message)) {
+        return false;
+    }
+    if (!claim_result(compiler, &operand, 1, target, result, error_message)) {
+        return false;
+    }
+    emit_op_unary(compiler, opcode, result->reg, operand.reg);
+    return true;
+}
+
+/* Literal-only operator expressions load their folded value; the rest fail to fold and compile normally. */
+static bool compile_constant_expression(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                                        char **error_message) {
+    FoldedValue folded;
+    if (!fold_expression(expression, &folded)) {
+        if (expression->type == EXPR_UNARY) {
+            return compile_unary(compiler, expression, target, result, error_message);
+        }
+        return compile_binary(compiler, expression, target, result, error_message);
+    }
+    bool ok = compile_folded(compiler, &folded, target, result, error_message);
+    folded_value_free(&folded);
+    return ok;
+}
+
 static bool compile_literal_string(Compiler *compiler, const char *text, char **error_message) {
     size_t length = text ? strlen(text) : 0;
     ObjString *string = obj_string_copy(compiler->vm, text, length);
@@ -537,10 +994,21 @@ static bool compile_literal_string(Compiler *compiler, const char *text, char **
     if (!push_stack_slot(compiler, error_message, &dest)) {
         return false;
     }
-    return emit_op_load_constant(compiler, dest, value_make_string(string), error_message);
+    vm_push(compiler->vm, value_make_string(string));
+    bool ok = emit_op_load_constant(compiler, dest, value_make_string(string), error_message);
+    vm_pop(compiler->vm);
+    return ok;
 }
 
-static bool compile_expression(Compiler *compiler, const Expression *expression, char **error_message) {
+/*
+ * Compile `expression` and report the register holding its value. Locals
+ * (and assignments to them) yield the local's own register, not a temporary;
+ * everything else leaves one temporary on top of the stack. Binary, unary,
+ * property and index expressions write straight into `target` when it is
+ * not -1.
+ */
+static bool compile_expression_node(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                                    char **error_message) {
     if (!expression) {
         compiler_errorf(error_message, "Null expression encountered during compilation.");
         return false;
@@ -551,16 +1019,22 @@ static bool compile_expression(Compiler *compiler, const Expression *expression,
             if (!push_stack_slot(compiler, error_message, &dest)) {
                 return false;
             }
+            *result = register_result_make(dest, true);
             return emit_op_load_constant(compiler, dest, value_make_number(expression->as.number_literal.value), error_message);
         }
         case EXPR_LITERAL_STRING:
-            return compile_literal_string(compiler, expression->as.string_literal.value, error_message);
+            if (!compile_literal_string(compiler, expression->as.string_literal.value, error_message)) {
+                return false;
+            }
+            *result = register_result_make(stack_top_register(compiler, 0), true);
+            return true;
         case EXPR_LITERAL_BOOL: {
             int dest = 0;
             if (!push_stack_slot(compiler, error_message, &dest)) {
                 return false;
             }
             emit_op_load_bool(compiler, dest, expression->as.bool_literal.value);
+            *result = register_result_make(dest, true);
             return true;
         }
         case EXPR_LITERAL_NULL: {
@@ -569,181 +1043,120 @@ static bool compile_expression(Compiler *compiler, const Expression *expression,
                 return false;
             }
             emit_op_load_null(compiler, dest);
+            *result = register_result_make(dest, true);
             return true;
         }
         case EXPR_IDENTIFIER: {
             const char *name = expression->as.identifier.name;
             int local = resolve_local(compiler, name, false, error_message);
-            int dest = 0;
-            if (!push_stack_slot(compiler, error_message, &dest)) {
-                return false;
-            }
             if (local >= 0) {
-                emit_op_move(compiler, dest, compiler->locals[local].reg);
+                *result = register_result_make(compiler->locals[local].reg, false);
                 return true;
             }
             int global = global_table_find(compiler->globals, name);
             if (global < 0) {
-                pop_stack_slots(compiler, 1);
                 compiler_errorf(error_message, "Undefined variable '%s'.", name);
                 return false;
             }
-            emit_op_get_global(compiler, dest, (uint16_t)global);
-            return true;
-        }
-        case EXPR_UNARY: {
-            if (!compile_expression(compiler, expression->as.unary.right, error_message)) {
+            int dest = 0;
+            if (!push_stack_slot(compiler, error_message, &dest)) {
                 return false;
             }
-            int reg = stack_top_register(compiler, 0);
-            switch (expression->as.unary.operator_type) {
-                case TOKEN_MINUS:
-                    emit_op_unary(compiler, OP_NEGATE, reg, reg);
-                    return true;
-                case TOKEN_BANG:
-                    emit_op_unary(compiler, OP_NOT, reg, reg);
-                    return true;
-                default:
-                    compiler_errorf(error_message, "Unsupported unary operator.");
-                    return false;
-            }
+            emit_op_get_global(compiler, dest, (uint16_t)global);
+            *result = register_result_make(dest, true);
+            return true;
         }
-        case EXPR_BINARY: {
-            if (!compile_expression(compiler, expression->as.binary.left, error_message)) {
-                return false;
-            }
-            if (!compile_expression(compiler, expression->as.binary.right, error_message)) {
-                return false;
+        case EXPR_UNARY:
+            if (expression->is_constant) {
+                return compile_constant_expression(compiler, expression, target, result, error_message);
             }
-            int right_reg = stack_top_register(compiler, 0);
-            int left_reg = stack_top_register(compiler, 1);
-            int dest_reg = left_reg;
-            switch (expression->as.binary.operator_type) {
-                case TOKEN_PLUS:
-                    emit_op_binary(compiler, OP_ADD, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_MINUS:
-                    emit_op_binary(compiler, OP_SUBTRACT, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_STAR:
-                    emit_op_binary(compiler, OP_MULTIPLY, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_SLASH:
-                    emit_op_binary(compiler, OP_DIVIDE, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_GREATER:
-                    emit_op_binary(compiler, OP_GREATER, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_GREATER_EQUAL:
-                    emit_op_binary(compiler, OP_LESS, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    emit_op_unary(compiler, OP_NOT, dest_reg, dest_reg);
-                    return true;
-                case TOKEN_LESS:
-                    emit_op_binary(compiler, OP_LESS, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_LESS_EQUAL:
-                    emit_op_binary(compiler, OP_GREATER, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    emit_op_unary(compiler, OP_NOT, dest_reg, dest_reg);
-                    return true;
-                case TOKEN_EQUAL_EQUAL:
-                    emit_op_binary(compiler, OP_EQUAL, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    return true;
-                case TOKEN_BANG_EQUAL:
-                    emit_op_binary(compiler, OP_EQUAL, dest_reg, left_reg, right_reg);
-                    pop_stack_slots(compiler, 1);
-                    emit_op_unary(compiler, OP_NOT, dest_reg, dest_reg);
-                    return true;
-                default:
-                    compiler_errorf(error_message, "Unsupported binary operator.");
-                    return false;
+            return compile_unary(compiler, expression, target, result, error_message);
+        case EXPR_BINARY:
+            if (expression->is_constant) {
+                return compile_constant_expression(compiler, expression, target, result, error_message);
             }
-        }
+            return compile_binary(compiler, expression, target, result, error_message);
         case EXPR_ASSIGNMENT:
-            return compile_assignment(compiler, expression, error_message);
+            return compile_assignment(compiler, expression, result, error_message);
         case EXPR_CALL:
-            return compile_call(compiler, expression, error_message);
+            return compile_call(compiler, expression, result, error_message);
         case EXPR_ARRAY:
-            return compile_array_literal(compiler, expression, error_message);
+            return compile_array_literal(compiler, expression, result, error_message);
         case EXPR_INDEX:
-            return compile_index_expression(compiler, expression, error_message);
+            return compile_index_expression(compiler, expression, target, result, error_message);
         case EXPR_THIS: {
             int local = resolve_local(compiler, "this", false, error_message);
             if (local < 0) {
                 compiler_errorf(error_message, "Cannot use 'this' outside of class method.");
                 return false;
             }
-            int dest = 0;
-            if (!push_stack_slot(compiler, error_message, &dest)) {
-                return false;
-            }
-            emit_op_move(compiler, dest, compiler->locals[local].reg);
+            *result = register_result_make(compiler->locals[local].reg, false);
             return true;
         }
         case EXPR_GET_PROPERTY: {
-            if (!compile_expression(compiler, expression->as.get_property.object, error_message)) {
+            RegisterResult object;
+            if (!compile_operand(compiler, expression->as.get_property.object, &object, error_message)) {
                 return false;
             }
             uint16_t name_index = 0;
             if (!make_string_constant(compiler, expression->as.get_property.name, &name_index, error_message)) {
                 return false;
             }
-            int object_reg = stack_top_register(compiler, 0);
-            emit_op_get_property(compiler, object_reg, object_reg, name_index);
+            if (!claim_result(compiler, &object, 1, target, result, error_message)) {
+                return false;
+            }
+            emit_op_get_property(compiler, result->reg, object.reg, name_index);
             return true;
         }
         case EXPR_SET_PROPERTY: {
-            if (!compile_expression(compiler, expression->as.set_property.object, error_message)) {
+            const Expression *value = expression->as.set_property.value;
+            RegisterResult object;
+            if (!compile_operand_before(compiler, expression->as.set_property.object, expression_assigns(value), &object,
+                                        error_message)) {
                 return false;
             }
-            if (!compile_expression(compiler, expression->as.set_property.value, error_message)) {
+            RegisterResult stored;
+            if (!compile_operand(compiler, value, &stored, error_message)) {
                 return false;
             }
-            int value_reg = stack_top_register(compiler, 0);
-            int object_reg = stack_top_register(compiler, 1);
             uint16_t name_index = 0;
             if (!make_string_constant(compiler, expression->as.set_property.name, &name_index, error_message)) {
                 return false;
             }
-            emit_op_set_property(compiler, object_reg, name_index, value_reg);
-            emit_op_move(compiler, object_reg, value_reg);
-            pop_stack_slots(compiler, 1);
+            emit_op_set_property(compiler, object.reg, name_index, stored.reg);
+            /* The expression's value is the stored one; keep it in the lowest temporary. */
+            if (object.is_temp && stored.is_temp) {
+                emit_op_move(compiler, object.reg, stored.reg);
+                pop_stack_slots(compiler, 1);
+                *result = object;
+                return true;
+            }
+            release_operand(compiler, object);
+            *result = stored;
             return true;
         }
         case EXPR_INVOKE: {
             if (!compile_expression(compiler, expression->as.invoke.object, error_message)) {
                 return false;
             }
+            int object_reg = stack_top_register(compiler, 0);
             size_t arg_count = expression->as.invoke.arguments.count;
             if (arg_count >= UINT8_MAX) {
                 compiler_errorf(error_message, "Too many arguments in method call.");
                 return false;
             }
-            for (size_t i = 0; i < arg_count; ++i) {
-                if (!compile_expression(compiler, expression->as.invoke.arguments.items[i], error_message)) {
-                    return false;
-                }
+            uint8_t arg_registers[UINT8_MAX];
+            int temps = 0;
+            if (!compile_operand_list(compiler, &expression->as.invoke.arguments, arg_registers, &temps, error_message)) {
+                return false;
             }
             uint16_t name_index = 0;
             if (!make_string_constant(compiler, expression->as.invoke.name, &name_index, error_message)) {
                 return false;
             }
-            int object_reg = stack_top_register(compiler, (int)arg_count);
-            uint8_t arg_registers[UINT8_MAX];
-            for (size_t i = 0; i < arg_count; ++i) {
-                int distance = (int)(arg_count - 1 - i);
-                arg_registers[i] = (uint8_t)stack_top_register(compiler, distance);
-            }
             emit_op_invoke(compiler, object_reg, object_reg, name_index, (uint8_t)arg_count, arg_registers);
-            pop_stack_slots(compiler, (int)arg_count);
+            pop_stack_slots(compiler, temps);
+            *result = register_result_make(object_reg, true);
             return true;
         }
     }
@@ -751,94 +1164,149 @@ static bool compile_expression(Compiler *compiler, const Expression *expression,
     return false;
 }
 
-static bool compile_assignment(Compiler *compiler, const Expression *expression, char **error_message) {
-    const char *name = expression->as.assignment.name;
-    if (!compile_expression(compiler, expression->as.assignment.value, error_message)) {
+/*
+ * Compile each expression in `list` as an operand, storing its register. An
+ * operand left in a local's register is copied when a later element may
+ * assign. Counts the temporaries left on the stack.
+ */
+static bool compile_operand_list(Compiler *compiler, const ExpressionList *list, uint8_t *registers, int *temps,
+                                 char **error_message) {
+    for (size_t i = 0; i < list->count; ++i) {
+        RegisterResult operand;
+        if (!compile_operand_before(compiler, list->items[i], list_assigns(list, i + 1), &operand, error_message)) {
+            return false;
+        }
+        registers[i] = (uint8_t)operand.reg;
+        *temps += operand.is_temp ? 1 : 0;
+    }
+    return true;
+}
+
+static bool compile_compound_append(Compiler *compiler, const Expression *value, int target, RegisterResult *result,
+                                    char **error_message) {
+    const Expression *right = value->as.binary.right;
+    bool constant_right = is_constant_operand(right);
+    RegisterResult operands[2];
+    if (!compile_operand_before(compiler, value->as.binary.left, !constant_right && expression_assigns(right), &operands[0],
+                                error_message)) {
         return false;
     }
+    uint16_t index = 0;
+    if (constant_right) {
+        if (!add_operand_constant(compiler, right, &index, error_message)) {
+            return false;
+        }
+    } else if (!compile_operand(compiler, right, &operands[1], error_message)) {
+        return false;
+    }
+    if (!claim_result(compiler, operands, constant_right ? 1 : 2, target, result, error_message)) {
+        return false;
+    }
+    if (constant_right) {
+        emit_op_binary_constant(compiler, OP_APPEND_K, result->reg, operands[0].reg, index);
+    } else {
+        emit_op_binary(compiler, OP_APPEND, result->reg, operands[0].reg, operands[1].reg);
+    }
+    return true;
+}
+
+static bool compile_assignment(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message) {
+    const char *name = expression->as.assignment.name;
+    const Expression *value = expression->as.assignment.value;
+    /* `x += v` is parsed as `x = x + v`; arrays are extended in place instead of copied. */
+    bool append = expression->as.assignment.compound && value->type == EXPR_BINARY && value->as.binary.operator_type == TOKEN_PLUS;
     int local = resolve_local(compiler, name, true, error_message);
     if (local >= 0) {
-        int value_reg = stack_top_register(compiler, 0);
-        emit_op_move(compiler, compiler->locals[local].reg, value_reg);
+        int target = compiler->locals[local].reg;
+        if (append) {
+            RegisterResult appended;
+            if (!compile_compound_append(compiler, value, target, &appended, error_message)) {
+                return false;
+            }
+        } else if (!compile_expression_into(compiler, value, target, error_message)) {
+            return false;
+        }
+        *result = register_result_make(target, false);
         return true;
     }
+    if (append) {
+        if (!compile_compound_append(compiler, value, -1, result, error_message)) {
+            return false;
+        }
+    } else if (!compile_operand(compiler, value, result, error_message)) {
+        return false;
+    }
     int global = global_table_find(compiler->globals, name);
     if (global < 0) {
         compiler_errorf(error_message, "Undefined variable '%s'.", name);
         return false;
     }
-    int value_reg = stack_top_register(compiler, 0);
-    emit_op_set_global(compiler, value_reg, (uint16_t)global);
+    emit_op_set_global(compiler, result->reg, (uint16_t)global);
     return true;
 }
 
-static bool compile_call(Compiler *compiler, const Expression *expression, char **error_message) {
+static bool compile_call(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message) {
     if (!compile_expression(compiler, expression->as.call.callee, error_message)) {
         return false;
     }
+    int callee_reg = stack_top_register(compiler, 0);
     if (expression->as.call.arguments.count > UINT8_MAX) {
         compiler_errorf(error_message, "Too many arguments in function call.");
         return false;
     }
     size_t arg_count = expression->as.call.arguments.count;
-    for (size_t i = 0; i < arg_count; ++i) {
-        if (!compile_expression(compiler, expression->as.call.arguments.items[i], error_message)) {
-            return false;
-        }
-    }
-    int callee_reg = stack_top_register(compiler, (int)arg_count);
     uint8_t arg_registers[UINT8_MAX];
-    for (size_t i = 0; i < arg_count; ++i) {
-        int distance = (int)(arg_count - 1 - i);
-        arg_registers[i] = (uint8_t)stack_top_register(compiler, distance);
+    int temps = 0;
+    if (!compile_operand_list(compiler, &expression->as.call.arguments, arg_registers, &temps, error_message)) {
+        return false;
     }
     emit_op_call(compiler, callee_reg, callee_reg, (uint8_t)arg_count, arg_registers);
-    pop_stack_slots(compiler, (int)arg_count);
+    pop_stack_slots(compiler, temps);
+    *result = register_result_make(callee_reg, true);
     return true;
 }
 
-static bool compile_array_literal(Compiler *compiler, const Expression *expression, char **error_message) {
+static bool compile_array_literal(Compiler *compiler, const Expression *expression, RegisterResult *result, char **error_message) {
     size_t element_count = expression->as.array_literal.elements.count;
     if (element_count > UINT8_MAX) {
         compiler_errorf(error_message, "Array literal has too many elements.");
         return false;
     }
 
-    if (element_count == 0) {
-        int dest = 0;
-        if (!push_stack_slot(compiler, error_message, &dest)) {
-            return false;
-        }
-        emit_op_build_array(compiler, dest, 0, NULL);
-        return true;
-    }
-
     uint8_t element_registers[UINT8_MAX];
-    for (size_t i = 0; i < element_count; ++i) {
-        Expression *element = expression->as.array_literal.elements.items[i];
-        if (!compile_expression(compiler, element, error_message)) {
+    int temps = 0;
+    if (!compile_operand_list(compiler, &expression->as.array_literal.elements, element_registers, &temps, error_message)) {
+        return false;
+    }
+    /* Temporaries sit contiguously on top of the stack; the lowest holds the array. */
+    int dest = 0;
+    if (temps == 0) {
+        if (!push_stack_slot(compiler, error_message, &dest)) {
             return false;
         }
-        element_registers[i] = (uint8_t)stack_top_register(compiler, 0);
+    } else {
+        dest = stack_top_register(compiler, temps - 1);
+        pop_stack_slots(compiler, temps - 1);
     }
-
-    int dest = element_registers[0];
     emit_op_build_array(compiler, dest, (uint8_t)element_count, element_registers);
-    pop_stack_slots(compiler, (int)element_count - 1);
+    *result = register_result_make(dest, true);
     return true;
 }
 
-static bool compile_index_expression(Compiler *compiler, const Expression *expression, char **error_message) {
-    if (!compile_expression(compiler, expression->as.index.array, error_message)) {
+static bool compile_index_expression(Compiler *compiler, const Expression *expression, int target, RegisterResult *result,
+                                     char **error_message) {
+    const Expression *index = expression->as.index.index;
+    RegisterResult operands[2];
+    if (!compile_operand_before(compiler, expression->as.index.array, expression_assigns(index), &operands[0], error_message)) {
         return false;
     }
-    if (!compile_expression(compiler, expression->as.index.index, error_message)) {
+    if (!compile_operand(compiler, index, &operands[1], error_message)) {
         return false;
     }
-    int index_reg = stack_top_register(compiler, 0);
-    int array_reg = stack_top_register(compiler, 1);
-    emit_op_array_get(compiler, array_reg, array_reg, index_reg);
-    pop_stack_slots(compiler, 1);
+    if (!claim_result(compiler, operands, 2, target, result, error_message)) {
+        return false;
+    }
+    emit_op_array_get(compiler, result->reg, operands[0].reg, operands[1].reg);
     return true;
 }
 
@@ -874,12 +1342,9 @@ static bool compile_let_statement(Compiler *compiler, const Statement *statement
         }
         Local *local = &compiler->locals[slot];
         if (has_initializer) {
-            if (!compile_expression(compiler, statement->as.let_statement.initializer, error_message)) {
+            if (!compile_expression_into(compiler, statement->as.let_statement.initializer, local->reg, error_message)) {
                 return false;
             }
-            int value_reg = stack_top_register(compiler, 0);
-            emit_op_move(compiler, local->reg, value_reg);
-            pop_stack_slots(compiler, 1);
         } else {
             emit_op_load_null(compiler, local->reg);
         }
@@ -893,12 +1358,12 @@ static bool compile_let_statement(Compiler *compiler, const Statement *statement
         return false;
     }
     if (has_initializer) {
-        if (!compile_expression(compiler, statement->as.let_statement.initializer, error_message)) {
+        RegisterResult value;
+        if (!compile_operand(compiler, statement->as.let_statement.initializer, &value, error_message)) {
             return false;
         }
-        int value_reg = stack_top_register(compiler, 0);
-        emit_op_define_global(compiler, value_reg, index);
-        pop_stack_slots(compiler, 1);
+        emit_op_define_global(compiler, value.reg, index);
+        release_operand(compiler, value);
     } else {
         int dest = 0;
         if (!push_stack_slot(compiler, error_message, &dest)) {
@@ -926,20 +1391,100 @@ static bool compile_expression_statement(Compiler *compiler, const Statement *st
         compiler->pending_value = register_result_make(stack_top_register(compiler, 0), true);
         return true;
     }
-    if (!compile_expression(compiler, statement->as.expression_statement.expression, error_message)) {
+    RegisterResult value;
+    if (!compile_operand(compiler, statement->as.expression_statement.expression, &value, error_message)) {
         return false;
     }
-    pop_stack_slots(compiler, 1);
+    release_operand(compiler, value);
     return true;
 }
 
+/* The fused branch taken when `a <operator> b` is false, or -1 for non-comparisons. */
+static int inverted_branch_opcode(TokenType operator_type) {
+    switch (operator_type) {
+        case TOKEN_LESS:
+            return OP_JUMP_IF_GE;
+        case TOKEN_LESS_EQUAL:
+            return OP_JUMP_IF_GT;
+        case TOKEN_GREATER:
+            return OP_JUMP_IF_LE;
+        case TOKEN_GREATER_EQUAL:
+            return OP_JUMP_IF_LT;
+        case TOKEN_EQUAL_EQUAL:
+            return OP_JUMP_IF_NE;
+        case TOKEN_BANG_EQUAL:
+            return OP_JUMP_IF_EQ;
+        default:
+            return -1;
+    }
+}
+
+static bool compile_compare_jump(Compiler *compiler, const Expression *condition, int opcode, int *jump_out, char **error_message) {
+    const Expression *left = condition->as.binary.left;
+    const Expression *right = condition->as.binary.right;
+    if (is_constant_operand(left) && !is_constant_operand(right)) {
+        opcode = inverted_branch_opcode(swapped_comparison(condition->as.binary.operator_type));
+        left = condition->as.binary.right;
+        right = condition->as.binary.left;
+    }
+    bool constant_right = is_constant_operand(right);
+    RegisterResult left_operand;
+    if (!compile_operand_before(compiler, left, !constant_right && expression_assigns(right), &left_operand, error_message)) {
+        return false;
+    }
+    if (constant_right) {
+        uint16_t index = 0;
+        if (!add_operand_constant(compiler, right, &index, error_message)) {
+            return false;
+        }
+        OpCode constant_opcode = (OpCode)(opcode - OP_JUMP_IF_LT + OP_JUMP_IF_LT_K);
+        *jump_out = emit_jump_compare_constant(compiler, constant_opcode, left_operand.reg, index);
+        release_operand(compiler, left_operand);
+        return true;
+    }
+    RegisterResult right_operand;
+    if (!compile_operand(compiler, right, &right_operand, error_message)) {
+        return false;
+    }
+    *jump_out = emit_jump_compare(compiler, (OpCode)opcode, left_operand.reg, right_operand.reg);
+    release_operand(compiler, right_operand);
+    release_operand(compiler, left_operand);
+    return true;
+}
+
+/*
+ * Evaluate `condition` and emit a forward jump taken when it is false,
+ * storing the operand offset to patch. Comparisons become one fused
+ * compare-and-branch rather than a compare into a temporary followed by
+ * OP_JUMP_IF_FALSE, with a literal on either side read straight from
+ * the constant pool.
+ */
+static bool compile_condition_jump(Compiler *compiler, const Expression *condition, int *jump_out, char **error_message) {
+    int opcode = -1;
+    if (condition && condition->type == EXPR_BINARY && !is_folded_constant(condition)) {
+        opcode = inverted_branch_opcode(condition->as.binary.operator_type);
+    }
+    if (opcode < 0) {
+        RegisterResult value;
+        if (!compile_operand(compiler, condition, &value, error_message)) {
+            return false;
+        }
+        *jump_out = emit_jump_if_false(compiler, value.reg);
+        release_operand(compiler, value);
+        return true;
+    }
+    int enclosing_line = compiler->line;
+    compiler->line = condition->line;
+    bool ok = compile_compare_jump(compiler, condition, opcode, jump_out, error_message);
+    compiler->line = enclosing_line;
+    return ok;
+}
+
 static bool compile_if_statement(Compiler *compiler, const Statement *statement, char **error_message) {
-    if (!compile_expression(compiler, statement->as.if_statement.condition, error_message)) {
+    int then_jump = 0;
+    if (!compile_condition_jump(compiler, statement->as.if_statement.condition, &then_jump, error_message)) {
         return false;
     }
-    int condition_reg = stack_top_register(compiler, 0);
-    int then_jump = emit_jump_if_false(compiler, condition_reg);
-    pop_stack_slots(compiler, 1);
 
     if (!compile_statement(compiler, statement->as.if_statement.then_branch, error_message)) {
         return false;
@@ -964,12 +1509,10 @@ static bool compile_if_statement(Compiler *compiler, const Statement *statement,
 
 static bool compile_while_statement(Compiler *compiler, const Statement *statement, char **error_message) {
     int loop_start = current_chunk(compiler)->count;
-    if (!compile_expression(compiler, statement->as.while_statement.condition, error_message)) {
+    int exit_jump = 0;
+    if (!compile_condition_jump(compiler, statement->as.while_statement.condition, &exit_jump, error_message)) {
         return false;
     }
-    int condition_reg = stack_top_register(compiler, 0);
-    int exit_jump = emit_jump_if_false(compiler, condition_reg);
-    pop_stack_slots(compiler, 1);
 
     if (!compile_statement(compiler, statement->as.while_statement.body, error_message)) {
         return false;
@@ -983,9 +1526,23 @@ static bool compile_while_statement(Compiler *compiler, const Statement *stateme
     return true;
 }
 
+static void finish_function(Compiler *compiler) {
+    PeepholeStats stats;
+    peephole_optimize(current_chunk(compiler), &stats);
+    if (compiler->vm->print_peephole_stats) {
+        const ObjString *name = compiler->function->name;
+        fprintf(stderr, "peephole: %s: %d -> %d instructions\n", name ? name->chars : "<fn>", stats.instructions_before,
+                stats.instructions_after);
+    }
+}
+
 static bool compile_function_body(Compiler *compiler, const Statement *body, char **error_message) {
     if (!body) {
-        return emit_return(compiler, error_message);
+        if (!emit_return(compiler, error_message)) {
+            return false;
+        }
+        finish_function(compiler);
+        return true;
     }
     if (body->type != STMT_BLOCK) {
         compiler_errorf(error_message, "Function body must be a block.");
@@ -998,7 +1555,11 @@ static bool compile_function_body(Compiler *compiler, const Statement *body, cha
         return false;
     }
     end_scope(compiler);
-    return emit_return(compiler, error_message);
+    if (!emit_return(compiler, error_message)) {
+        return false;
+    }
+    finish_function(compiler);
+    return true;
 }
 
 static bool compile_method(Compiler *compiler, const ClassMethod *method, int class_reg, char **error_message) {
@@ -1135,12 +1696,12 @@ static bool compile_return_statement(Compiler *compiler, const Statement *statem
         return false;
     }
     if (statement->as.return_statement.has_value) {
-        if (!compile_expression(compiler, statement->as.return_statement.value, error_message)) {
+        RegisterResult value;
+        if (!compile_operand(compiler, statement->as.return_statement.value, &value, error_message)) {
             return false;
         }
-        int value_reg = stack_top_register(compiler, 0);
-        emit_return_value(compiler, value_reg);
-        pop_stack_slots(compiler, 1);
+        emit_return_value(compiler, value.reg);
+        release_operand(compiler, value);
     } else {
         if (!emit_return(compiler, error_message)) {
             return false;
@@ -1209,6 +1770,14 @@ static bool compile_statement(Compiler *compiler, const Statement *statement, ch
     if (!statement) {
         return true;
     }
+    int enclosing_line = compiler->line;
+    compiler->line = statement->line;
+    bool ok = compile_statement_node(compiler, statement, error_message);
+    compiler->line = enclosing_line;
+    return ok;
+}
+
+static bool compile_statement_node(Compiler *compiler, const Statement *statement, char **error_message) {
     if (statement->type != STMT_EXPRESSION) {
         discard_pending_expression(compiler);
     }
@@ -1270,17 +1839,14 @@ ObjFunction *compiler_compile(VM *vm, const Program *program, char **error_messa
         global_table_free(&compilation.globals);
         return NULL;
     }
+    finish_function(&compiler);
 
     vm_pop(vm);
     global_table_free(&compilation.globals);
     return function;
 }
 
-bool compiler_run_program(VM *vm, const Program *program, Value *result_out, char **error_message) {
-    ObjFunction *function = compiler_compile(vm, program, error_message);
-    if (!function) {
-        return false;
-    }
+bool compiler_run_function(VM *vm, ObjFunction *function, Value *result_out, char **error_message) {
     Value result = value_make_null();
     InterpretResult status = vm_interpret(vm, function, &result);
     if (status != INTERPRET_OK) {
@@ -1293,11 +1859,19 @@ bool compiler_run_program(VM *vm, const Program *program, Value *result_out, cha
     return true;
 }
 
-bool compiler_run_source(VM *vm, const char *source, Value *result_out, char **error_message) {
-    if (!vm || !source) {
-        compiler_errorf(error_message, "Invalid arguments to run_source.");
+bool compiler_run_program(VM *vm, const Program *program, Value *result_out, char **error_message) {
+    ObjFunction *function = compiler_compile(vm, program, error_message);
+    if (!function) {
         return false;
     }
+    return compiler_run_function(vm, function, result_out, error_message);
+}
+
+ObjFunction *compiler_compile_source(VM *vm, const char *source, char **error_message) {
+    if (!vm || !source) {
+        compiler_errorf(error_message, "Invalid arguments to compile_source.");
+        return NULL;
+    }
     char *parse_error = NULL;
     Program *program = parser_parse(source, &parse_error);
     if (!program) {
@@ -1310,10 +1884,22 @@ bool compiler_run_source(VM *vm, const char *source, Value *result_out, char **e
         } else {
             compiler_errorf(error_message, "Parsing failed.");
         }
-        return false;
+        return NULL;
     }
 
-    bool ok = compiler_run_program(vm, program, result_out, error_message);
+    ObjFunction *function = compiler_compile(vm, program, error_message);
     program_free(program);
-    return ok;
+    return function;
+}
+
+bool compiler_run_source(VM *vm, const char *source, Value *result_out, char **error_message) {
+    if (!vm || !source) {
+        compiler_errorf(error_message, "Invalid arguments to run_source.");
+        return false;
+    }
+    ObjFunction *function = compiler_compile_source(vm, source, error_message);
+    if (!function) {
+        return false;
+    }
+    return compiler_run_function(vm, function, result_out, error_message);
 }
@@ -14,6 +14,20 @@
  */
 ObjFunction *compiler_compile(VM *vm, const Program *program, char **error_message);
 
+/**
+ * Parse and compile a source string without running it. On failure, returns
+ * NULL and, if error_message is not NULL, stores a heap-allocated description
+ * from either the parser or compiler stages.
+ */
+ObjFunction *compiler_compile_source(VM *vm, const char *source, char **error_message);
+
+/**
+ * Execute a compiled script function. Returns true on success. On failure,
+ * returns false and, if error_message is not NULL, stores a heap-allocated
+ * description.
+ */
+bool compiler_run_function(VM *vm, ObjFunction *function, Value *result_out, char **error_message);
+
 /**
  * Convenience helper to compile a program AST and immediately execute it via
  * the VM. Returns true on success. On failure, returns false and, if
@@ -0,0 +1,191 @@
+#include "fold.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void fold_number(FoldedValue *out, double number) {
+    out->kind = FOLD_NUMBER;
+    out->number = number;
+}
+
+static void fold_bool(FoldedValue *out, bool boolean) {
+    out->kind = FOLD_BOOL;
+    out->boolean = boolean;
+}
+
+/* Mirrors value_is_truthy. */
+static bool folded_truthy(const FoldedValue *value) {
+    if (value->kind == FOLD_NULL) {
+        return false;
+    }
+    if (value->kind == FOLD_BOOL) {
+        return value->boolean;
+    }
+    return true;
+}
+
+/* Mirrors value_equals. */
+static bool folded_equal(const FoldedValue *a, const FoldedValue *b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+        case FOLD_NULL:
+            return true;
+        case FOLD_BOOL:
+            return a->boolean == b->boolean;
+        case FOLD_NUMBER:
+            return a->number == b->number;
+        case FOLD_STRING:
+            return a->length == b->length && memcmp(a->chars, b->chars, a->length) == 0;
+    }
+    return false;
+}
+
+static bool fold_concatenate(const FoldedValue *a, const FoldedValue *b, FoldedValue *out) {
+    size_t length = a->length + b->length;
+    char *chars = (char *)malloc(length + 1);
+    if (!chars) {
+        fprintf(stderr, "Failed to fold string constant.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    out->kind = FOLD_STRING;
+    out->chars = chars;
+    out->length = length;
+    out->owned = chars;
+    return true;
+}
+
+static bool fold_unary(TokenType operator_type, const FoldedValue *operand, FoldedValue *out) {
+    switch (operator_type) {
+        case TOKEN_MINUS:
+            if (operand->kind != FOLD_NUMBER) {
+                return false;
+            }
+            fold_number(out, -operand->number);
+            return true;
+        case TOKEN_BANG:
+            fold_bool(out, !folded_truthy(operand));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool fold_binary(TokenType operator_type, const FoldedValue *a, const FoldedValue *b, FoldedValue *out) {
+    bool numbers = a->kind == FOLD_NUMBER && b->kind == FOLD_NUMBER;
+    switch (operator_type) {
+        case TOKEN_PLUS:
+            if (numbers) {
+                fold_number(out, a->number + b->number);
+                return true;
+            }
+            if (a->kind == FOLD_STRING && b->kind == FOLD_STRING) {
+                return fold_concatenate(a, b, out);
+            }
+            return false;
+        case TOKEN_MINUS:
+            if (numbers) {
+                fold_number(out, a->number - b->number);
+            }
+            return numbers;
+        case TOKEN_STAR:
+            if (numbers) {
+                fold_number(out, a->number * b->number);
+            }
+            return numbers;
+        case TOKEN_SLASH:
+            if (numbers) {
+                fold_number(out, a->number / b->number);
+            }
+            return numbers;
+        case TOKEN_GREATER:
+            if (numbers) {
+                fold_bool(out, a->number > b->number);
+            }
+            return numbers;
+        case TOKEN_GREATER_EQUAL:
+            if (numbers) {
+                fold_bool(out, !(a->number < b->number));
+            }
+            return numbers;
+        case TOKEN_LESS:
+            if (numbers) {
+                fold_bool(out, a->number < b->number);
+            }
+            return numbers;
+        case TOKEN_LESS_EQUAL:
+            if (numbers) {
+                fold_bool(out, !(a->number > b->number));
+            }
+            return numbers;
+        case TOKEN_EQUAL_EQUAL:
+            fold_bool(out, folded_equal(a, b));
+            return true;
+        case TOKEN_BANG_EQUAL:
+            fold_bool(out, !folded_equal(a, b));
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool fold_expression(const Expression *expression, FoldedValue *out) {
+    memset(out, 0, sizeof(*out));
+    if (!expression->is_constant) {
+        return false;
+    }
+    switch (expression->type) {
+        case EXPR_LITERAL_NUMBER:
+            fold_number(out, expression->as.number_literal.value);
+            return true;
+        case EXPR_LITERAL_STRING: {
+            const char *text = expression->as.string_literal.value;
+            out->kind = FOLD_STRING;
+            out->chars = text ? text : "";
+            out->length = strlen(out->chars);
+            return true;
+        }
+        case EXPR_LITERAL_BOOL:
+            fold_bool(out, expression->as.bool_literal.value);
+            return true;
+        case EXPR_LITERAL_NULL:
+            out->kind = FOLD_NULL;
+            return true;
+        case EXPR_UNARY: {
+            FoldedValue operand;
+            if (!fold_expression(expression->as.unary.right, &operand)) {
+                return false;
+            }
+            bool ok = fold_unary(expression->as.unary.operator_type, &operand, out);
+            folded_value_free(&operand);
+            return ok;
+        }
+        case EXPR_BINARY: {
+            FoldedValue left;
+            if (!fold_expression(expression->as.binary.left, &left)) {
+                return false;
+            }
+            FoldedValue right;
+            if (!fold_expression(expression->as.binary.right, &right)) {
+                folded_value_free(&left);
+                return false;
+            }
+            bool ok = fold_binary(expression->as.binary.operator_type, &left, &right, out);
+            folded_value_free(&left);
+            folded_value_free(&right);
+            return ok;
+        }
+        default:
+            return false;
+    }
+}
+
+void folded_value_free(FoldedValue *value) {
+    free(value->owned);
+    value->owned = NULL;
+}
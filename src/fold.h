@@ -0,0 +1,37 @@
+#ifndef VIBELANG_FOLD_H
+#define VIBELANG_FOLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+/*
+ * Compile-time evaluation of expressions built only from literals. Results
+ * match what the VM would compute: IEEE double arithmetic, `<=` and `>=` as
+ * the negations of `>` and `<`, `+` concatenating two strings. Expressions
+ * that would raise a runtime error, such as `1 + "a"` or `-"a"`, are left
+ * unfolded so the error still happens at run time.
+ */
+typedef enum {
+    FOLD_NULL,
+    FOLD_BOOL,
+    FOLD_NUMBER,
+    FOLD_STRING
+} FoldKind;
+
+typedef struct {
+    FoldKind kind;
+    bool boolean;
+    double number;
+    /* FOLD_STRING: `length` bytes, NUL-terminated; `owned` is set when they were allocated by folding. */
+    const char *chars;
+    size_t length;
+    char *owned;
+} FoldedValue;
+
+/* On success the caller must release `out` with folded_value_free. */
+bool fold_expression(const Expression *expression, FoldedValue *out);
+void folded_value_free(FoldedValue *value);
+
+#endif
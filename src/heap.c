@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)
+
+struct HeapPage {
+    HeapPage *next;
+    HeapPage *previous_available;
+    HeapPage *next_available;
+    Obj *free_list;
+    /* Cells at or past `bump` have never been handed out. */
+    uint32_t bump;
+    uint32_t cell_size;
+    uint32_t cell_count;
+    uint32_t live_count;
+    uint8_t size_class;
+    bool available;
+    uint64_t live[PAGE_BITMAP_WORDS];
+};
+
+#define PAGE_HEADER_SIZE ((sizeof(HeapPage) + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1))
+
+struct LargeObject {
+    LargeObject *next;
+    LargeObject *previous;
+};
+
+static HeapPage *page_of(const Obj *object) {
+    return (HeapPage *)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+static Obj *page_cell(const HeapPage *page, uint32_t index) {
+    return (Obj *)((char *)page + PAGE_HEADER_SIZE + (size_t)index * page->cell_size);
+}
+
+static uint32_t cell_index(const HeapPage *page, const Obj *object) {
+    return (uint32_t)(((const char *)object - (const char *)page - PAGE_HEADER_SIZE) / page->cell_size);
+}
+
+static Obj *large_object_cell(LargeObject *large) {
+    return (Obj *)(large + 1);
+}
+
+static LargeObject *cell_large_object(const Obj *object) {
+    return (LargeObject *)object - 1;
+}
+
+/* First live cell at or after `*index`, which is updated to its position. */
+static Obj *find_live_cell(const HeapPage *page, uint32_t *index) {
+    uint32_t position = *index;
+    while (position < page->bump) {
+        uint64_t word = page->live[position / 64] >> (position % 64);
+        if (word == 0) {
+            position = (position / 64 + 1) * 64;
+            continue;
+        }
+        while (!(word & 1)) {
+            word >>= 1;
+            position++;
+        }
+        if (position >= page->bump) {
+            break;
+        }
+        *index = position;
+        return page_cell(page, position);
+    }
+    return NULL;
+}
+
+static Obj *first_live_from(const Heap *heap, const HeapPage *page, uint32_t index) {
+    for (; page; page = page->next, index = 0) {
+        Obj *cell = find_live_cell(page, &index);
+        if (cell) {
+            return cell;
+        }
+    }
+    return heap->large_objects ? large_object_cell(heap->large_objects) : NULL;
+}
+
+static void link_available(Heap *heap, HeapPage *page) {
+    HeapPage *head = heap->available[page->size_class];
+    page->previous_available = NULL;
+    page->next_available = head;
+    if (head) {
+        head->previous_available = page;
+    }
+    heap->available[page->size_class] = page;
+    page->available = true;
+}
+
+static void unlink_available(Heap *heap, HeapPage *page) {
+    if (page->previous_available) {
+        page->previous_available->next_available = page->next_available;
+    } else {
+        heap->available[page->size_class] = page->next_available;
+    }
+    if (page->next_available) {
+        page->next_available->previous_available = page->previous_available;
+    }
+    page->previous_available = NULL;
+    page->next_available = NULL;
+    page->available = false;
+}
+
+static HeapPage *new_page(Heap *heap, uint8_t size_class) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, HEAP_PAGE_SIZE, HEAP_PAGE_SIZE) != 0) {
+        fprintf(stderr, "Out of memory while growing the object heap.\n");
+        exit(EXIT_FAILURE);
+    }
+    HeapPage *page = (HeapPage *)memory;
+    page->free_list = NULL;
+    page->bump = 0;
+    page->cell_size = (uint32_t)(size_class + 1) * HEAP_GRANULE;
+    page->cell_count = (uint32_t)((HEAP_PAGE_SIZE - PAGE_HEADER_SIZE) / page->cell_size);
+    page->live_count = 0;
+    page->size_class = size_class;
+    memset(page->live, 0, sizeof(page->live));
+    page->next = heap->pages;
+    heap->pages = page;
+    heap->page_count++;
+    link_available(heap, page);
+    return page;
+}
+
+static Obj *allocate_large(Heap *heap, size_t size) {
+    LargeObject *large = (LargeObject *)malloc(sizeof(LargeObject) + size);
+    if (!large) {
+        fprintf(stderr, "Out of memory while allocating an object.\n");
+        exit(EXIT_FAILURE);
+    }
+    large->previous = NULL;
+    large->next = heap->large_objects;
+    if (heap->large_objects) {
+        heap->large_objects->previous = large;
+    }
+    heap->large_objects = large;
+    Obj *object = large_object_cell(large);
+    object->size_class = 0;
+    return object;
+}
+
+void heap_init(Heap *heap) {
+    heap->pages = NULL;
+    for (int i = 0; i < HEAP_SIZE_CLASS_COUNT; ++i) {
+        heap->available[i] = NULL;
+    }
+    heap->large_objects = NULL;
+    heap->page_count = 0;
+    heap->sweep_link = NULL;
+    heap->sweep_index = 0;
+    heap->sweep_large = NULL;
+}
+
+void heap_free(Heap *heap) {
+    HeapPage *page = heap->pages;
+    while (page) {
+        HeapPage *next = page->next;
+        free(page);
+        page = next;
+    }
+    LargeObject *large = heap->large_objects;
+    while (large) {
+        LargeObject *next = large->next;
+        free(large);
+        large = next;
+    }
+    heap_init(heap);
+}
+
+Obj *heap_allocate(Heap *heap, size_t size) {
+    if (size > HEAP_MAX_CELL_SIZE) {
+        return allocate_large(heap, size);
+    }
+    uint8_t size_class = (uint8_t)((size + HEAP_GRANULE - 1) / HEAP_GRANULE - 1);
+    HeapPage *page = heap->available[size_class];
+    if (!page) {
+        page = new_page(heap, size_class);
+    }
+    Obj *cell = page->free_list;
+    if (cell) {
+        page->free_list = cell->next;
+    } else {
+        cell = page_cell(page, page->bump++);
+    }
+    uint32_t index = cell_index(page, cell);
+    page->live[index / 64] |= (uint64_t)1 << (index % 64);
+    page->live_count++;
+    if (!page->free_list && page->bump == page->cell_count) {
+        unlink_available(heap, page);
+    }
+    cell->size_class = (uint8_t)(size_class + 1);
+    return cell;
+}
+
+void heap_release(Heap *heap, Obj *object) {
+    if (object->size_class == 0) {
+        LargeObject *large = cell_large_object(object);
+        if (heap->sweep_large == large) {
+            heap->sweep_large = large->next;
+        }
+        if (large->previous) {
+            large->previous->next = large->next;
+        } else {
+            heap->large_objects = large->next;
+        }
+        if (large->next) {
+            large->next->previous = large->previous;
+        }
+        free(large);
+        return;
+    }
+    HeapPage *page = page_of(object);
+    uint32_t index = cell_index(page, object);
+    page->live[index / 64] &= ~((uint64_t)1 << (index % 64));
+    page->live_count--;
+    object->next = page->free_list;
+    page->free_list = object;
+    if (!page->available) {
+        link_available(heap, page);
+    }
+}
+
+Obj *heap_first(const Heap *heap) {
+    return first_live_from(heap, heap->pages, 0);
+}
+
+Obj *heap_next(const Heap *heap, const Obj *object) {
+    if (object->size_class == 0) {
+        LargeObject *next = cell_large_object(object)->next;
+        return next ? large_object_cell(next) : NULL;
+    }
+    HeapPage *page = page_of(object);
+    return first_live_from(heap, page, cell_index(page, object) + 1);
+}
+
+void heap_sweep_begin(Heap *heap) {
+    heap->sweep_link = &heap->pages;
+    heap->sweep_index = 0;
+    heap->sweep_large = heap->large_objects;
+}
+
+Obj *heap_sweep_next(Heap *heap) {
+    while (heap->sweep_link && *heap->sweep_link) {
+        HeapPage *page = *heap->sweep_link;
+        uint32_t index = heap->sweep_index;
+        Obj *cell = find_live_cell(page, &index);
+        if (cell) {
+            heap->sweep_index = index + 1;
+            return cell;
+        }
+        if (page->live_count == 0) {
+            *heap->sweep_link = page->next;
+            if (page->available) {
+                unlink_available(heap, page);
+            }
+            free(page);
+            heap->page_count--;
+        } else {
+            heap->sweep_link = &page->next;
+        }
+        heap->sweep_index = 0;
+    }
+    heap->sweep_link = NULL;
+    LargeObject *large = heap->sweep_large;
+    if (!large) {
+        return NULL;
+    }
+    heap->sweep_large = large->next;
+    return large_object_cell(large);
+}
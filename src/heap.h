@@ -0,0 +1,54 @@
+#ifndef VIBELANG_HEAP_H
+#define VIBELANG_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object.h"
+
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 16
+#define HEAP_SIZE_CLASS_COUNT 16
+#define HEAP_MAX_CELL_SIZE (HEAP_GRANULE * HEAP_SIZE_CLASS_COUNT)
+
+/*
+ * Object memory owned by the VM. Objects up to HEAP_MAX_CELL_SIZE bytes live
+ * in HEAP_PAGE_SIZE pages of equal cells, one size class (a multiple of
+ * HEAP_GRANULE) per page. Each page keeps a bitmap of the cells that hold
+ * objects and a free list of the ones that do not; pages with free cells are
+ * linked per size class. Larger objects get their own malloc block. The heap
+ * only hands out and takes back memory: what counts as garbage is decided by
+ * the collector, which walks the heap with the sweep cursor.
+ */
+typedef struct HeapPage HeapPage;
+typedef struct LargeObject LargeObject;
+
+typedef struct {
+    HeapPage *pages;
+    HeapPage *available[HEAP_SIZE_CLASS_COUNT];
+    LargeObject *large_objects;
+    size_t page_count;
+    HeapPage **sweep_link;
+    uint32_t sweep_index;
+    LargeObject *sweep_large;
+} Heap;
+
+void heap_init(Heap *heap);
+/* Releases every page and large block; objects are not finalised. */
+void heap_free(Heap *heap);
+/* Uninitialised memory for a `size`-byte object, with only Obj.size_class set. */
+Obj *heap_allocate(Heap *heap, size_t size);
+void heap_release(Heap *heap, Obj *object);
+/* Every allocated object, page by page and then the large ones. */
+Obj *heap_first(const Heap *heap);
+Obj *heap_next(const Heap *heap, const Obj *object);
+/*
+ * Sweep cursor over the same order. Releasing the object just returned is
+ * allowed; pages found empty are given back to the system as the cursor
+ * leaves them. Objects allocated after heap_sweep_begin may or may not be
+ * visited. Returns NULL once the walk is complete.
+ */
+void heap_sweep_begin(Heap *heap);
+Obj *heap_sweep_next(Heap *heap);
+
+#endif
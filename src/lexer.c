@@ -34,7 +34,10 @@ static void skip_whitespace(Lexer *lexer) {
             case ' ':
             case '\r':
             case '\t':
+                advance(lexer);
+                break;
             case '\n':
+                lexer->line++;
                 advance(lexer);
                 break;
             case '/':
@@ -52,41 +55,23 @@ static void skip_whitespace(Lexer *lexer) {
     }
 }
 
-static char *duplicate_lexeme(const char *start, size_t length) {
-    char *copy = (char *)malloc(length + 1);
-    if (!copy) {
-        return NULL;
-    }
-    if (length > 0) {
-        memcpy(copy, start, length);
-    }
-    copy[length] = '\0';
-    return copy;
-}
-
-static Token make_token_from_range(TokenType type, const char *start, size_t length) {
+static Token make_token_from_range(TokenType type, const char *start, size_t length, int line) {
     Token token;
     token.type = type;
-    token.lexeme = duplicate_lexeme(start, length);
+    token.start = start;
+    token.length = length;
     token.number_value = 0.0;
-    if (!token.lexeme) {
-        token.type = TOKEN_ERROR;
-        token.lexeme = duplicate_lexeme("Out of memory", strlen("Out of memory"));
-    }
+    token.line = line;
     return token;
 }
 
 static Token make_token(const Lexer *lexer, TokenType type) {
     size_t length = (size_t)(lexer->current - lexer->start);
-    return make_token_from_range(type, lexer->start, length);
+    return make_token_from_range(type, lexer->start, length, lexer->line);
 }
 
-static Token make_error_token(const char *message) {
-    Token token;
-    token.type = TOKEN_ERROR;
-    token.lexeme = duplicate_lexeme(message, strlen(message));
-    token.number_value = 0.0;
-    return token;
+static Token make_error_token(const Lexer *lexer, const char *message) {
+    return make_token_from_range(TOKEN_ERROR, message, strlen(message), lexer->line);
 }
 
 static bool match(Lexer *lexer, char expected) {
@@ -106,14 +91,14 @@ static Token string(Lexer *lexer) {
     }
 
     if (is_at_end(lexer) || peek(lexer) != '"') {
-        return make_error_token("Unterminated string literal");
+        return make_error_token(lexer, "Unterminated string literal");
     }
 
     advance(lexer); // Consume closing quote.
 
     size_t literal_length = (size_t)(lexer->current - lexer->start - 2);
     const char *literal_start = lexer->start + 1;
-    return make_token_from_range(TOKEN_STRING, literal_start, literal_length);
+    return make_token_from_range(TOKEN_STRING, literal_start, literal_length, lexer->line);
 }
 
 static Token number(Lexer *lexer) {
@@ -128,9 +113,22 @@ static Token number(Lexer *lexer) {
         }
     }
 
+    /* strtod needs a terminated copy: the source continues past the slice. */
     Token token = make_token(lexer, TOKEN_NUMBER);
-    if (token.type != TOKEN_ERROR && token.lexeme) {
-        token.number_value = strtod(token.lexeme, NULL);
+    char buffer[64];
+    if (token.length < sizeof(buffer)) {
+        memcpy(buffer, token.start, token.length);
+        buffer[token.length] = '\0';
+        token.number_value = strtod(buffer, NULL);
+    } else {
+        char *copy = (char *)malloc(token.length + 1);
+        if (!copy) {
+            return make_error_token(lexer, "Out of memory");
+        }
+        memcpy(copy, token.start, token.length);
+        copy[token.length] = '\0';
+        token.number_value = strtod(copy, NULL);
+        free(copy);
     }
     return token;
 }
@@ -203,25 +201,14 @@ static Token identifier(Lexer *lexer) {
         advance(lexer);
     }
 
-    Token token = make_token(lexer, TOKEN_IDENTIFIER);
-    if (token.type == TOKEN_ERROR) {
-        return token;
-    }
-
-    size_t length = strlen(token.lexeme);
-    TokenType type = identifier_type(token.lexeme, length);
-    if (type == TOKEN_IDENTIFIER) {
-        return token;
-    }
-
-    Token keyword_token = make_token_from_range(type, token.lexeme, length);
-    token_free(&token);
-    return keyword_token;
+    size_t length = (size_t)(lexer->current - lexer->start);
+    return make_token(lexer, identifier_type(lexer->start, length));
 }
 
 void lexer_init(Lexer *lexer, const char *source) {
     lexer->start = source;
     lexer->current = source;
+    lexer->line = 1;
 }
 
 Token lexer_next_token(Lexer *lexer) {
@@ -229,7 +216,7 @@ Token lexer_next_token(Lexer *lexer) {
     lexer->start = lexer->current;
 
     if (is_at_end(lexer)) {
-        return make_token_from_range(TOKEN_EOF, lexer->current, 0);
+        return make_token_from_range(TOKEN_EOF, lexer->current, 0, lexer->line);
     }
 
     char c = advance(lexer);
@@ -271,12 +258,5 @@ Token lexer_next_token(Lexer *lexer) {
             break;
     }
 
-    return make_error_token("Unexpected character");
-}
-
-void token_free(Token *token) {
-    if (token && token->lexeme) {
-        free(token->lexeme);
-        token->lexeme = NULL;
-    }
+    return make_error_token(lexer, "Unexpected character");
 }
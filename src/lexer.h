@@ -46,19 +46,26 @@ typedef enum {
     TOKEN_ERROR
 } TokenType;
 
+/*
+ * Tokens borrow their text from the source buffer: `start`/`length` slice the
+ * lexeme (string literals exclude the quotes), so the source must outlive
+ * them. Error tokens instead point at a static NUL-terminated message.
+ */
 typedef struct {
     TokenType type;
-    char *lexeme;
+    const char *start;
+    size_t length;
     double number_value;
+    int line;
 } Token;
 
 typedef struct {
     const char *start;
     const char *current;
+    int line;
 } Lexer;
 
 void lexer_init(Lexer *lexer, const char *source);
 Token lexer_next_token(Lexer *lexer);
-void token_free(Token *token);
 
 #endif
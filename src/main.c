@@ -1,13 +1,17 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "bytecode.h"
 #include "compiler.h"
 #include "object.h"
 #include "value.h"
 
-static char *read_file(const char *path) {
+static char *read_file(const char *path, size_t *length_out) {
     FILE *file = fopen(path, "rb");
     if (!file) {
         return NULL;
@@ -30,51 +34,136 @@ static char *read_file(const char *path) {
     size_t read = fread(buffer, 1, (size_t)size, file);
     fclose(file);
     buffer[read] = '\0';
+    *length_out = read;
     return buffer;
 }
 
+/* script.vibe caches to script.vibec; any other name gets ".vibec" appended. */
+static char *cache_path_for(const char *path) {
+    size_t length = strlen(path);
+    const char *suffix = ".vibe";
+    size_t suffix_length = strlen(suffix);
+    bool has_suffix = length >= suffix_length && strcmp(path + length - suffix_length, suffix) == 0;
+    char *cache_path = (char *)malloc(length + (has_suffix ? 2 : 7));
+    if (!cache_path) {
+        return NULL;
+    }
+    memcpy(cache_path, path, length);
+    strcpy(cache_path + length, has_suffix ? "c" : ".vibec");
+    return cache_path;
+}
+
+static ObjFunction *load_script(VM *vm, const char *path, const char *source, size_t length, bool use_cache,
+                                char **error) {
+    struct stat info;
+    char *cache_path = NULL;
+    uint64_t hash = 0;
+    int64_t mtime = 0;
+    if (use_cache && stat(path, &info) == 0) {
+        cache_path = cache_path_for(path);
+        hash = bytecode_hash_source(source, length);
+        mtime = (int64_t)info.st_mtime;
+    }
+    if (cache_path) {
+        ObjFunction *cached = bytecode_read_file(vm, cache_path, hash, mtime);
+        if (cached) {
+            free(cache_path);
+            return cached;
+        }
+    }
+    ObjFunction *function = compiler_compile_source(vm, source, error);
+    if (function && cache_path) {
+        /* A cache that cannot be written only costs the next run a compile. */
+        bytecode_write_file(cache_path, function, hash, mtime);
+    }
+    free(cache_path);
+    return function;
+}
+
 static void print_value(Value value) {
-    switch (value.type) {
-        case VAL_NULL:
-            printf("null\n");
-            break;
-        case VAL_BOOL:
-            printf(value.as.boolean ? "true\n" : "false\n");
-            break;
-        case VAL_NUMBER:
-            printf("%g\n", value.as.number);
-            break;
-        case VAL_OBJ:
-            if (value_is_string(value)) {
-                ObjString *string = value_as_string(value);
-                printf("%s\n", string && string->chars ? string->chars : "");
-            } else if (value_is_function(value)) {
-                ObjFunction *function = value_as_function(value);
-                const char *name = (function && function->name && function->name->chars) ? function->name->chars : "<fn>";
-                printf("<function %s>\n", name);
-            } else {
-                printf("<object>\n");
-            }
-            break;
+    if (value_is_null(value)) {
+        printf("null\n");
+    } else if (value_is_bool(value)) {
+        printf(value_as_bool(value) ? "true\n" : "false\n");
+    } else if (value_is_number(value)) {
+        printf("%g\n", value_as_number(value));
+    } else if (value_is_string(value)) {
+        ObjString *string = value_as_string(value);
+        printf("%s\n", string ? string->chars : "");
+    } else if (value_is_function(value)) {
+        ObjFunction *function = value_as_function(value);
+        const char *name = (function && function->name) ? function->name->chars : "<fn>";
+        printf("<function %s>\n", name);
+    } else {
+        printf("<object>\n");
     }
 }
 
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--ic-stats] [--gc-stats] [--peephole-stats] [--no-cache] <script-file>\n", program);
+}
+
+static void print_inline_cache_stats(const VM *vm) {
+    size_t total = vm->ic_hits + vm->ic_misses;
+    double rate = total > 0 ? 100.0 * (double)vm->ic_hits / (double)total : 0.0;
+    fprintf(stderr, "inline caches: %zu hits, %zu misses (%.2f%% hit rate)\n", vm->ic_hits, vm->ic_misses, rate);
+}
+
+static void print_gc_stats(const VM *vm) {
+    fprintf(stderr, "gc: %zu full collections in %zu slices, %zu minor collections (longest %.3f ms)\n",
+            vm->gc_major_collections, vm->gc_slices, vm->gc_minor_collections, (double)vm->gc_max_minor_pause_ns / 1e6);
+    fprintf(stderr, "gc: %.3f ms paused (longest %.3f ms), %.3f ms of sweeping moved out of pauses\n",
+            (double)vm->gc_pause_ns / 1e6, (double)vm->gc_max_pause_ns / 1e6, (double)vm->gc_lazy_sweep_ns / 1e6);
+    fprintf(stderr, "gc: %zu heap pages of %d KB in use\n", vm->heap.page_count, HEAP_PAGE_SIZE / 1024);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <script-file>\n", argc > 0 ? argv[0] : "vibelang");
+    const char *program = argc > 0 ? argv[0] : "vibelang";
+    const char *path = NULL;
+    bool ic_stats = false;
+    bool gc_stats = false;
+    bool peephole_stats = false;
+    bool use_cache = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ic-stats") == 0) {
+            ic_stats = true;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i], "--peephole-stats") == 0) {
+            peephole_stats = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        } else if (argv[i][0] == '-' || path) {
+            print_usage(program);
+            return EXIT_FAILURE;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        print_usage(program);
         return EXIT_FAILURE;
     }
-    char *source = read_file(argv[1]);
+    size_t source_length = 0;
+    char *source = read_file(path, &source_length);
     if (!source) {
-        fprintf(stderr, "Failed to read file '%s'.\n", argv[1]);
+        fprintf(stderr, "Failed to read file '%s'.\n", path);
         return EXIT_FAILURE;
     }
 
     VM vm;
     vm_init(&vm);
+    vm.print_peephole_stats = peephole_stats;
     Value result = value_make_null();
     char *error = NULL;
-    bool ok = compiler_run_source(&vm, source, &result, &error);
+    ObjFunction *function = load_script(&vm, path, source, source_length, use_cache, &error);
+    bool ok = function && compiler_run_function(&vm, function, &result, &error);
+    if (ic_stats) {
+        print_inline_cache_stats(&vm);
+    }
+    if (gc_stats) {
+        print_gc_stats(&vm);
+    }
     if (!ok) {
         if (error) {
             fprintf(stderr, "%s\n", error);
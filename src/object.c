@@ -4,13 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "heap.h"
 #include "table.h"
 #include "vm.h"
 
-static uint32_t hash_bytes(const char *chars, size_t length) {
-    const uint32_t FNV_OFFSET = 2166136261u;
-    const uint32_t FNV_PRIME = 16777619u;
-    uint32_t hash = FNV_OFFSET;
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/* FNV-1a over `chars`, continuing from `hash` so pieces can be hashed in turn. */
+static uint32_t hash_bytes(uint32_t hash, const char *chars, size_t length) {
     for (size_t i = 0; i < length; ++i) {
         hash ^= (uint32_t)(unsigned char)chars[i];
         hash *= FNV_PRIME;
@@ -18,32 +20,58 @@ static uint32_t hash_bytes(const char *chars, size_t length) {
     return hash;
 }
 
-static Obj *allocate_object(VM *vm, size_t size, ObjType type) {
-    Obj *object = (Obj *)malloc(size);
-    if (!object) {
-        fprintf(stderr, "Failed to allocate object.\n");
-        exit(EXIT_FAILURE);
+static void collect_if_needed(VM *vm, size_t incoming) {
+    size_t projected = vm->bytes_allocated + incoming;
+    if (vm->gc_phase == GC_PHASE_MARKING) {
+        if (projected > vm->gc_next_slice) {
+            vm_collect_step(vm);
+        }
+    } else if (vm->gc_phase == GC_PHASE_SWEEPING && projected > vm->next_gc * 2) {
+        /* Allocations sweep lazily; a step only finishes the sweep if the heap runs away. */
+        vm_collect_step(vm);
+    } else if (vm->gc_phase == GC_PHASE_IDLE && projected > vm->next_gc) {
+        vm_collect_step(vm);
+    } else if (vm->gc_nursery_size > 0 && projected > vm->bytes_at_last_gc + vm->gc_nursery_size) {
+        vm_collect_nursery(vm);
     }
+}
+
+static Obj *allocate_object(VM *vm, size_t size, ObjType type) {
+    collect_if_needed(vm, size);
+    Obj *object = vm_allocate_cell(vm, size);
     object->type = type;
-    object->marked = false;
-    object->next = vm->objects;
-    vm->objects = object;
+    object->mark = 0;
+    object->remembered = false;
     vm->bytes_allocated += size;
+    if (type == OBJ_FUNCTION) {
+        /*
+         * Functions are long-lived, so they start old (black during a cycle).
+         * Stores into their names, constants and inline caches go through
+         * the write barrier.
+         */
+        object->mark = vm->gc_epoch;
+        object->next = NULL;
+        return object;
+    }
+    object->next = vm->young_objects;
+    vm->young_objects = object;
     return object;
 }
 
-static ObjString *allocate_string(VM *vm, char *chars, size_t length, uint32_t hash) {
-    ObjString *string = (ObjString *)allocate_object(vm, sizeof(ObjString), OBJ_STRING);
+/* A new string with uninitialised characters; the caller fills them in and interns it. */
+static ObjString *allocate_string(VM *vm, size_t length, uint32_t hash) {
+    ObjString *string = (ObjString *)allocate_object(vm, sizeof(ObjString) + length + 1, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
-    string->chars[length] = '\0';
     string->hash = hash;
-    vm->bytes_allocated += length + 1;
+    string->chars[length] = '\0';
     return string;
 }
 
 static bool array_resize(VM *vm, ValueArray *array, size_t new_capacity) {
     size_t old_bytes = array->capacity * sizeof(Value);
+    if (new_capacity > array->capacity) {
+        collect_if_needed(vm, (new_capacity - array->capacity) * sizeof(Value));
+    }
     Value *values = NULL;
     if (new_capacity > 0) {
         values = (Value *)realloc(array->values, new_capacity * sizeof(Value));
@@ -71,6 +99,7 @@ static bool ensure_property_capacity(VM *vm, ObjProperty **entries, size_t *capa
             return false;
         }
     }
+    collect_if_needed(vm, (new_capacity - current) * sizeof(ObjProperty));
     ObjProperty *storage = (ObjProperty *)realloc(*entries, new_capacity * sizeof(ObjProperty));
     if (!storage) {
         return false;
@@ -85,6 +114,48 @@ static bool ensure_property_capacity(VM *vm, ObjProperty **entries, size_t *capa
     return true;
 }
 
+static bool ensure_slot_capacity(VM *vm, ObjInstance *instance, size_t required) {
+    size_t current = instance->slot_capacity;
+    if (current >= required) {
+        return true;
+    }
+    size_t new_capacity = current == 0 ? 4 : current;
+    while (new_capacity < required) {
+        new_capacity *= 2;
+        if (new_capacity < current) {
+            return false;
+        }
+    }
+    collect_if_needed(vm, (new_capacity - current) * sizeof(Value));
+    Value *slots = (Value *)realloc(instance->slots, new_capacity * sizeof(Value));
+    if (!slots) {
+        return false;
+    }
+    vm->bytes_allocated += (new_capacity - current) * sizeof(Value);
+    instance->slots = slots;
+    instance->slot_capacity = new_capacity;
+    return true;
+}
+
+/* Covers the elements from `from` to the end of the array. */
+static void array_write_barrier(VM *vm, ObjArray *array, size_t from) {
+    if (obj_is_young(&array->obj)) {
+        return;
+    }
+    if (vm->gc_phase == GC_PHASE_MARKING) {
+        for (size_t i = from; i < array->elements.count; ++i) {
+            vm_write_barrier(vm, &array->obj, array->elements.values[i]);
+        }
+        return;
+    }
+    if (!array->obj.remembered) {
+        array->dirty_from = from;
+        vm_remember(vm, &array->obj);
+    } else if (from < array->dirty_from) {
+        array->dirty_from = from;
+    }
+}
+
 static void array_ensure_capacity_or_die(VM *vm, ValueArray *array, size_t min_capacity) {
     if (array->capacity >= min_capacity) {
         return;
@@ -111,6 +182,7 @@ ObjArray *obj_array_new(VM *vm) {
     array->elements.values = NULL;
     array->elements.count = 0;
     array->elements.capacity = 0;
+    array->dirty_from = 0;
     return array;
 }
 
@@ -120,9 +192,12 @@ ObjArray *obj_array_copy(VM *vm, const Value *values, size_t count) {
         return NULL;
     }
     if (count > 0) {
+        vm_push(vm, value_make_array(array));
         array_ensure_capacity_or_die(vm, &array->elements, count);
         memcpy(array->elements.values, values, count * sizeof(Value));
         array->elements.count = count;
+        array_write_barrier(vm, array, 0);
+        vm_pop(vm);
     }
     return array;
 }
@@ -133,6 +208,9 @@ bool obj_array_append(VM *vm, ObjArray *array, Value value) {
     }
     array_ensure_capacity_or_die(vm, &array->elements, array->elements.count + 1);
     array->elements.values[array->elements.count++] = value;
+    if (value_is_obj(value) && value_as_obj(value)->mark != vm->gc_epoch) {
+        array_write_barrier(vm, array, array->elements.count - 1);
+    }
     return true;
 }
 
@@ -144,9 +222,17 @@ bool obj_array_extend(VM *vm, ObjArray *array, const Value *values, size_t count
         return false;
     }
     size_t new_count = array->elements.count + count;
+    const Value *old_values = array->elements.values;
+    bool aliased = old_values && values >= old_values && values < old_values + array->elements.count;
+    size_t offset = aliased ? (size_t)(values - old_values) : 0;
     array_ensure_capacity_or_die(vm, &array->elements, new_count);
+    if (aliased) {
+        values = array->elements.values + offset;
+    }
     memcpy(array->elements.values + array->elements.count, values, count * sizeof(Value));
+    size_t old_count = array->elements.count;
     array->elements.count = new_count;
+    array_write_barrier(vm, array, old_count);
     return true;
 }
 
@@ -159,6 +245,8 @@ ObjClass *obj_class_new(VM *vm, ObjString *name) {
     klass->methods = NULL;
     klass->method_count = 0;
     klass->method_capacity = 0;
+    klass->constructor = NULL;
+    klass->instance_slot_count = 0;
     return klass;
 }
 
@@ -166,9 +254,13 @@ bool obj_class_define_method(VM *vm, ObjClass *klass, ObjString *name, Value met
     if (!vm || !klass || !name) {
         return false;
     }
+    if (name == vm->names[VM_NAME_CONSTRUCTOR]) {
+        klass->constructor = value_is_function(method) ? value_as_function(method) : NULL;
+    }
     for (size_t i = 0; i < klass->method_count; ++i) {
         if (klass->methods[i].name == name) {
             klass->methods[i].value = method;
+            vm_write_barrier(vm, &klass->obj, method);
             return true;
         }
     }
@@ -178,6 +270,8 @@ bool obj_class_define_method(VM *vm, ObjClass *klass, ObjString *name, Value met
     klass->methods[klass->method_count].name = name;
     klass->methods[klass->method_count].value = method;
     klass->method_count++;
+    vm_write_barrier(vm, &klass->obj, value_make_string(name));
+    vm_write_barrier(vm, &klass->obj, method);
     return true;
 }
 
@@ -202,9 +296,17 @@ ObjInstance *obj_instance_new(VM *vm, ObjClass *klass) {
     }
     ObjInstance *instance = (ObjInstance *)allocate_object(vm, sizeof(ObjInstance), OBJ_INSTANCE);
     instance->klass = klass;
-    instance->fields = NULL;
-    instance->field_count = 0;
-    instance->field_capacity = 0;
+    instance->shape = vm->root_shape;
+    instance->slots = NULL;
+    instance->slot_capacity = 0;
+    if (klass->instance_slot_count > 0) {
+        vm_push(vm, value_make_instance(instance));
+        if (!ensure_slot_capacity(vm, instance, klass->instance_slot_count)) {
+            fprintf(stderr, "Failed to allocate instance slots.\n");
+            exit(EXIT_FAILURE);
+        }
+        vm_pop(vm);
+    }
     return instance;
 }
 
@@ -212,33 +314,42 @@ bool obj_instance_get_field(ObjInstance *instance, ObjString *name, Value *out)
     if (!instance || !name) {
         return false;
     }
-    for (size_t i = 0; i < instance->field_count; ++i) {
-        if (instance->fields[i].name == name) {
-            if (out) {
-                *out = instance->fields[i].value;
-            }
-            return true;
-        }
+    int slot = shape_find_slot(instance->shape, name);
+    if (slot < 0) {
+        return false;
     }
-    return false;
+    if (out) {
+        *out = instance->slots[slot];
+    }
+    return true;
 }
 
 bool obj_instance_set_field(VM *vm, ObjInstance *instance, ObjString *name, Value value) {
     if (!vm || !instance || !name) {
         return false;
     }
-    for (size_t i = 0; i < instance->field_count; ++i) {
-        if (instance->fields[i].name == name) {
-            instance->fields[i].value = value;
-            return true;
-        }
+    int slot = shape_find_slot(instance->shape, name);
+    if (slot >= 0) {
+        instance->slots[slot] = value;
+        vm_write_barrier(vm, &instance->obj, value);
+        return true;
     }
-    if (!ensure_property_capacity(vm, &instance->fields, &instance->field_capacity, instance->field_count + 1)) {
+    return obj_instance_transition(vm, instance, vm_shape_transition(vm, instance->shape, name), value);
+}
+
+bool obj_instance_transition(VM *vm, ObjInstance *instance, Shape *next, Value value) {
+    if (!vm || !instance || !next || next->parent != instance->shape) {
         return false;
     }
-    instance->fields[instance->field_count].name = name;
-    instance->fields[instance->field_count].value = value;
-    instance->field_count++;
+    if (!ensure_slot_capacity(vm, instance, next->slot_count)) {
+        return false;
+    }
+    instance->slots[next->slot_count - 1] = value;
+    vm_write_barrier(vm, &instance->obj, value);
+    instance->shape = next;
+    if (next->slot_count > instance->klass->instance_slot_count) {
+        instance->klass->instance_slot_count = next->slot_count;
+    }
     return true;
 }
 
@@ -252,42 +363,40 @@ ObjBoundMethod *obj_bound_method_new(VM *vm, Value receiver, ObjFunction *method
     return bound;
 }
 
-ObjString *obj_string_take(VM *vm, char *chars, size_t length) {
-    if (!vm || !chars) {
-        free(chars);
+ObjString *obj_string_copy(VM *vm, const char *chars, size_t length) {
+    if (!vm || (!chars && length > 0)) {
         return NULL;
     }
-    uint32_t hash = hash_bytes(chars, length);
+    if (!chars) {
+        chars = "";
+    }
+    uint32_t hash = hash_bytes(FNV_OFFSET, chars, length);
     ObjString *interned = table_find_string(&vm->strings, chars, length, hash);
     if (interned) {
-        free(chars);
         return interned;
     }
-
-    ObjString *string = allocate_string(vm, chars, length, hash);
-    vm_push(vm, value_make_string(string));
+    ObjString *string = allocate_string(vm, length, hash);
+    memcpy(string->chars, chars, length);
     table_define(&vm->strings, string);
-    vm_pop(vm);
     return string;
 }
 
-ObjString *obj_string_copy(VM *vm, const char *chars, size_t length) {
-    if (!vm || (!chars && length > 0)) {
+ObjString *obj_string_concat(VM *vm, const ObjString *a, const ObjString *b) {
+    if (!vm || !a || !b) {
         return NULL;
     }
-    if (!chars) {
-        chars = "";
-    }
-    char *heap_chars = (char *)malloc(length + 1);
-    if (!heap_chars) {
-        fprintf(stderr, "Failed to allocate string characters.\n");
-        exit(EXIT_FAILURE);
-    }
-    if (length > 0) {
-        memcpy(heap_chars, chars, length);
+    size_t length = a->length + b->length;
+    uint32_t hash = hash_bytes(hash_bytes(FNV_OFFSET, a->chars, a->length), b->chars, b->length);
+    ObjString *interned = table_find_concat(&vm->strings, a, b, hash);
+    if (interned) {
+        return interned;
     }
-    heap_chars[length] = '\0';
-    return obj_string_take(vm, heap_chars, length);
+    /* `a` and `b` are still reachable from the caller's registers across the allocation. */
+    ObjString *string = allocate_string(vm, length, hash);
+    memcpy(string->chars, a->chars, a->length);
+    memcpy(string->chars + a->length, b->chars, b->length);
+    table_define(&vm->strings, string);
+    return string;
 }
 
 ObjFunction *obj_function_new(VM *vm, const char *name, int arity) {
@@ -301,12 +410,21 @@ ObjFunction *obj_function_new(VM *vm, const char *name, int arity) {
     chunk_init(&function->chunk);
     if (name) {
         size_t length = strlen(name);
+        vm_push(vm, value_make_function(function));
         function->name = obj_string_copy(vm, name, length);
+        vm_write_barrier(vm, &function->obj, value_make_string(function->name));
+        vm_pop(vm);
     }
     return function;
 }
 
-void obj_free(VM *vm, Obj *object) {
+uint16_t obj_function_add_constant(VM *vm, ObjFunction *function, Value value) {
+    uint16_t index = chunk_add_constant(&function->chunk, value);
+    vm_write_barrier(vm, &function->obj, value);
+    return index;
+}
+
+void obj_release(VM *vm, Obj *object) {
     if (!vm || !object) {
         return;
     }
@@ -315,15 +433,11 @@ void obj_free(VM *vm, Obj *object) {
             ObjFunction *function = (ObjFunction *)object;
             chunk_free(&function->chunk);
             vm->bytes_allocated -= sizeof(ObjFunction);
-            free(function);
             break;
         }
         case OBJ_STRING: {
             ObjString *string = (ObjString *)object;
-            vm->bytes_allocated -= sizeof(ObjString);
-            vm->bytes_allocated -= string->length + 1;
-            free(string->chars);
-            free(string);
+            vm->bytes_allocated -= sizeof(ObjString) + string->length + 1;
             break;
         }
         case OBJ_ARRAY: {
@@ -331,7 +445,6 @@ void obj_free(VM *vm, Obj *object) {
             vm->bytes_allocated -= sizeof(ObjArray);
             vm->bytes_allocated -= array->elements.capacity * sizeof(Value);
             free(array->elements.values);
-            free(array);
             break;
         }
         case OBJ_CLASS: {
@@ -339,26 +452,28 @@ void obj_free(VM *vm, Obj *object) {
             vm->bytes_allocated -= sizeof(ObjClass);
             vm->bytes_allocated -= klass->method_capacity * sizeof(ObjProperty);
             free(klass->methods);
-            free(klass);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance *)object;
             vm->bytes_allocated -= sizeof(ObjInstance);
-            vm->bytes_allocated -= instance->field_capacity * sizeof(ObjProperty);
-            free(instance->fields);
-            free(instance);
+            vm->bytes_allocated -= instance->slot_capacity * sizeof(Value);
+            free(instance->slots);
             break;
         }
-        case OBJ_BOUND_METHOD: {
-            ObjBoundMethod *bound = (ObjBoundMethod *)object;
+        case OBJ_BOUND_METHOD:
             vm->bytes_allocated -= sizeof(ObjBoundMethod);
-            free(bound);
             break;
-        }
         default:
-            free(object);
             break;
     }
 }
 
+void obj_free(VM *vm, Obj *object) {
+    if (!vm || !object) {
+        return;
+    }
+    obj_release(vm, object);
+    heap_release(&vm->heap, object);
+}
+
@@ -6,6 +6,7 @@
 #include <stddef.h>
 
 #include "chunk.h"
+#include "shape.h"
 
 typedef struct VM VM;
 
@@ -18,17 +19,34 @@ typedef enum {
     OBJ_BOUND_METHOD
 } ObjType;
 
+/*
+ * `mark` holds the epoch of the last collection that reached the object, and
+ * 0 for objects allocated since (the young generation, VM.young_objects).
+ * Outside a full cycle every old object carries the VM's current epoch, so a
+ * minor collection stops at the generation boundary; starting a full cycle
+ * bumps the epoch, which turns the whole heap white at once. `remembered` is
+ * set while an old object is in the remembered set because it may point at
+ * young ones. `size_class` is owned by the heap, and `next` links young
+ * objects (and free heap cells).
+ */
 typedef struct Obj {
     ObjType type;
-    bool marked;
+    uint8_t mark;
+    bool remembered;
+    uint8_t size_class;
     struct Obj *next;
 } Obj;
 
+static inline bool obj_is_young(const Obj *object) {
+    return object->mark == 0;
+}
+
+/* The characters follow the header in the same allocation, NUL-terminated. */
 typedef struct ObjString {
     Obj obj;
     size_t length;
-    char *chars;
     uint32_t hash;
+    char chars[];
 } ObjString;
 
 typedef struct ObjFunction {
@@ -42,6 +60,8 @@ typedef struct ObjFunction {
 typedef struct ObjArray {
     Obj obj;
     ValueArray elements;
+    /* Arrays only grow at the end: while remembered, elements before this index hold no young objects. */
+    size_t dirty_from;
 } ObjArray;
 
 typedef struct ObjProperty {
@@ -55,14 +75,16 @@ typedef struct ObjClass {
     ObjProperty *methods;
     size_t method_count;
     size_t method_capacity;
+    ObjFunction *constructor;
+    size_t instance_slot_count;
 } ObjClass;
 
 typedef struct ObjInstance {
     Obj obj;
     ObjClass *klass;
-    ObjProperty *fields;
-    size_t field_count;
-    size_t field_capacity;
+    Shape *shape;
+    Value *slots;
+    size_t slot_capacity;
 } ObjInstance;
 
 typedef struct ObjBoundMethod {
@@ -144,8 +166,10 @@ static inline ObjBoundMethod *value_as_bound_method(Value value) {
 }
 
 ObjFunction *obj_function_new(VM *vm, const char *name, int arity);
+/* Adds `value` to the function's constant pool behind the write barrier; functions start old. */
+uint16_t obj_function_add_constant(VM *vm, ObjFunction *function, Value value);
 ObjString *obj_string_copy(VM *vm, const char *chars, size_t length);
-ObjString *obj_string_take(VM *vm, char *chars, size_t length);
+ObjString *obj_string_concat(VM *vm, const ObjString *a, const ObjString *b);
 ObjArray *obj_array_new(VM *vm);
 ObjArray *obj_array_copy(VM *vm, const Value *values, size_t count);
 bool obj_array_append(VM *vm, ObjArray *array, Value value);
@@ -156,7 +180,10 @@ bool obj_class_find_method(ObjClass *klass, ObjString *name, Value *out);
 ObjInstance *obj_instance_new(VM *vm, ObjClass *klass);
 bool obj_instance_get_field(ObjInstance *instance, ObjString *name, Value *out);
 bool obj_instance_set_field(VM *vm, ObjInstance *instance, ObjString *name, Value value);
+bool obj_instance_transition(VM *vm, ObjInstance *instance, Shape *next, Value value);
 ObjBoundMethod *obj_bound_method_new(VM *vm, Value receiver, ObjFunction *method);
+/* Frees the buffers `object` owns but not the object itself. */
+void obj_release(VM *vm, Obj *object);
 void obj_free(VM *vm, Obj *object);
 
 #endif
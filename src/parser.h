@@ -1,6 +1,7 @@
 #ifndef VIBELANG_PARSER_H
 #define VIBELANG_PARSER_H
 
+#include "arena.h"
 #include "lexer.h"
 
 #include <stdbool.h>
@@ -36,6 +37,9 @@ typedef enum {
 
 struct Expression {
     ExpressionType type;
+    int line;
+    /* Built only from literals and operators, so the compiler may fold it. */
+    bool is_constant;
     union {
         struct {
             double value;
@@ -61,6 +65,7 @@ struct Expression {
         struct {
             char *name;
             Expression *value;
+            bool compound;
         } assignment;
         struct {
             Expression *callee;
@@ -120,6 +125,7 @@ struct ClassMethod {
 
 struct Statement {
     StatementType type;
+    int line;
     union {
         struct {
             char *name;
@@ -161,8 +167,10 @@ struct Statement {
     } as;
 };
 
+/* Every node, list and name of a program lives in its arena. */
 typedef struct Program {
     StatementList statements;
+    Arena arena;
 } Program;
 
 Program *parser_parse(const char *source, char **error_message);
@@ -0,0 +1,675 @@
+#include "peephole.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+
+/* Each round can expose more work (a threaded jump becomes `JUMP +0`, ...). */
+#define PEEPHOLE_MAX_ROUNDS 8
+#define PEEPHOLE_MAX_HOPS 16
+
+typedef struct {
+    uint64_t bits[4];
+} RegisterSet;
+
+typedef struct {
+    int offset;
+    int length;
+    uint8_t opcode;
+    /* Byte offset of the jump destination, or -1 for non-jumps. */
+    int target;
+    /* Register written, or -1. */
+    int dest;
+    /* Constant pool and inline cache indices the instruction reads, or -1. */
+    int constant;
+    int cache;
+    /* Whether `constant` must be a string (a property, method or class name). */
+    bool constant_is_name;
+    RegisterSet use;
+    RegisterSet live_in;
+    RegisterSet live_out;
+    int line;
+    bool reachable;
+    bool is_target;
+    bool removed;
+} Instruction;
+
+static void set_add(RegisterSet *set, uint8_t reg) {
+    set->bits[reg >> 6] |= UINT64_C(1) << (reg & 63);
+}
+
+static bool set_contains(const RegisterSet *set, int reg) {
+    return (set->bits[reg >> 6] >> (reg & 63)) & 1;
+}
+
+static void *checked_calloc(size_t count, size_t size) {
+    void *memory = calloc(count > 0 ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Out of memory while optimizing bytecode.\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+static int read_short(const uint8_t *code, int offset) {
+    return (code[offset] << 8) | code[offset + 1];
+}
+
+static bool is_jump(uint8_t opcode) {
+    return (opcode >= OP_JUMP && opcode <= OP_JUMP_IF_NE_K) || opcode == OP_LOOP;
+}
+
+static bool is_unconditional_jump(uint8_t opcode) {
+    return opcode == OP_JUMP || opcode == OP_LOOP;
+}
+
+static bool falls_through(uint8_t opcode) {
+    return !is_unconditional_jump(opcode) && opcode != OP_RETURN;
+}
+
+/* Instructions with no effect beyond writing `dest`. */
+static bool is_pure(uint8_t opcode) {
+    switch (opcode) {
+        case OP_LOAD_CONST:
+        case OP_LOAD_NULL:
+        case OP_LOAD_TRUE:
+        case OP_LOAD_FALSE:
+        case OP_MOVE:
+        case OP_NOT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void use_registers(Instruction *instruction, const uint8_t *code, int from, int count) {
+    for (int i = 0; i < count; ++i) {
+        set_add(&instruction->use, code[from + i]);
+    }
+}
+
+/* Fills in length, registers and jump target of the instruction at `offset`. */
+static bool decode_instruction(const uint8_t *code, int count, int offset, Instruction *out) {
+    memset(out, 0, sizeof(*out));
+    out->offset = offset;
+    out->opcode = code[offset];
+    out->target = -1;
+    out->dest = -1;
+    out->constant = -1;
+    out->cache = -1;
+    int remaining = count - offset;
+    switch (out->opcode) {
+        case OP_LOAD_CONST:
+        case OP_CLASS:
+        case OP_GET_GLOBAL:
+            out->length = 4;
+            break;
+        case OP_LOAD_NULL:
+        case OP_LOAD_TRUE:
+        case OP_LOAD_FALSE:
+        case OP_RETURN:
+            out->length = 2;
+            break;
+        case OP_MOVE:
+        case OP_NEGATE:
+        case OP_NOT:
+            out->length = 3;
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ARRAY_GET:
+        case OP_APPEND:
+        case OP_ADD_NUM:
+        case OP_APPEND_NUM:
+        case OP_EQUAL_NUM:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            out->length = 4;
+            break;
+        case OP_ADD_K:
+        case OP_SUBTRACT_K:
+        case OP_MULTIPLY_K:
+        case OP_DIVIDE_K:
+        case OP_EQUAL_K:
+        case OP_GREATER_K:
+        case OP_LESS_K:
+        case OP_APPEND_K:
+        case OP_JUMP_IF_LT:
+        case OP_JUMP_IF_LE:
+        case OP_JUMP_IF_GT:
+        case OP_JUMP_IF_GE:
+        case OP_JUMP_IF_EQ:
+        case OP_JUMP_IF_NE:
+        case OP_METHOD:
+            out->length = 5;
+            break;
+        case OP_JUMP_IF_LT_K:
+        case OP_JUMP_IF_LE_K:
+        case OP_JUMP_IF_GT_K:
+        case OP_JUMP_IF_GE_K:
+        case OP_JUMP_IF_EQ_K:
+        case OP_JUMP_IF_NE_K:
+            out->length = 6;
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            out->length = 3;
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            out->length = 7;
+            break;
+        case OP_CALL:
+            if (remaining < 4) {
+                return false;
+            }
+            out->length = 4 + code[offset + 3];
+            break;
+        case OP_BUILD_ARRAY:
+            if (remaining < 3) {
+                return false;
+            }
+            out->length = 3 + code[offset + 2];
+            break;
+        case OP_INVOKE:
+            if (remaining < 8) {
+                return false;
+            }
+            out->length = 8 + code[offset + 7];
+            break;
+        default:
+            return false;
+    }
+    if (out->length > remaining) {
+        return false;
+    }
+
+    const uint8_t *at = code + offset;
+    switch (out->opcode) {
+        case OP_LOAD_CONST:
+        case OP_LOAD_NULL:
+        case OP_LOAD_TRUE:
+        case OP_LOAD_FALSE:
+        case OP_CLASS:
+        case OP_GET_GLOBAL:
+            out->dest = at[1];
+            break;
+        case OP_MOVE:
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_ADD_K:
+        case OP_SUBTRACT_K:
+        case OP_MULTIPLY_K:
+        case OP_DIVIDE_K:
+        case OP_EQUAL_K:
+        case OP_GREATER_K:
+        case OP_LESS_K:
+        case OP_APPEND_K:
+        case OP_GET_PROPERTY:
+            out->dest = at[1];
+            use_registers(out, at, 2, 1);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ARRAY_GET:
+        case OP_APPEND:
+        case OP_ADD_NUM:
+        case OP_APPEND_NUM:
+        case OP_EQUAL_NUM:
+            out->dest = at[1];
+            use_registers(out, at, 2, 2);
+            break;
+        case OP_RETURN:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+            use_registers(out, at, 1, 1);
+            break;
+        case OP_SET_PROPERTY:
+        case OP_METHOD:
+            use_registers(out, at, 1, 1);
+            use_registers(out, at, 4, 1);
+            break;
+        case OP_CALL:
+            out->dest = at[1];
+            use_registers(out, at, 2, 1);
+            use_registers(out, at, 4, at[3]);
+            break;
+        case OP_BUILD_ARRAY:
+            out->dest = at[1];
+            use_registers(out, at, 3, at[2]);
+            break;
+        case OP_INVOKE:
+            out->dest = at[1];
+            use_registers(out, at, 2, 1);
+            use_registers(out, at, 8, at[7]);
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_LT_K:
+        case OP_JUMP_IF_LE_K:
+        case OP_JUMP_IF_GT_K:
+        case OP_JUMP_IF_GE_K:
+        case OP_JUMP_IF_EQ_K:
+        case OP_JUMP_IF_NE_K:
+            use_registers(out, at, 1, 1);
+            break;
+        case OP_JUMP_IF_LT:
+        case OP_JUMP_IF_LE:
+        case OP_JUMP_IF_GT:
+        case OP_JUMP_IF_GE:
+        case OP_JUMP_IF_EQ:
+        case OP_JUMP_IF_NE:
+            use_registers(out, at, 1, 2);
+            break;
+        default:
+            break;
+    }
+
+    switch (out->opcode) {
+        case OP_LOAD_CONST:
+        case OP_JUMP_IF_LT_K:
+        case OP_JUMP_IF_LE_K:
+        case OP_JUMP_IF_GT_K:
+        case OP_JUMP_IF_GE_K:
+        case OP_JUMP_IF_EQ_K:
+        case OP_JUMP_IF_NE_K:
+            out->constant = read_short(at, 2);
+            break;
+        case OP_ADD_K:
+        case OP_SUBTRACT_K:
+        case OP_MULTIPLY_K:
+        case OP_DIVIDE_K:
+        case OP_EQUAL_K:
+        case OP_GREATER_K:
+        case OP_LESS_K:
+        case OP_APPEND_K:
+            out->constant = read_short(at, 3);
+            break;
+        case OP_CLASS:
+        case OP_METHOD:
+            out->constant = read_short(at, 2);
+            out->constant_is_name = true;
+            break;
+        case OP_SET_PROPERTY:
+            out->constant = read_short(at, 2);
+            out->constant_is_name = true;
+            out->cache = read_short(at, 5);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_INVOKE:
+            out->constant = read_short(at, 3);
+            out->constant_is_name = true;
+            out->cache = read_short(at, 5);
+            break;
+        default:
+            break;
+    }
+
+    /* Every jump keeps its 16-bit distance in the last two bytes. */
+    if (is_jump(out->opcode)) {
+        int end = offset + out->length;
+        int distance = read_short(code, end - 2);
+        out->target = out->opcode == OP_LOOP ? end - distance : end + distance;
+    }
+    return true;
+}
+
+typedef struct {
+    Instruction *instructions;
+    int count;
+    /* Instruction index starting at each byte offset (-1 mid-instruction); [code count] maps to `count`. */
+    int *index_at;
+    /* Private copy of the code that rewrites are applied to. */
+    uint8_t *code;
+    int code_count;
+} DecodedChunk;
+
+static void program_free(DecodedChunk *program) {
+    free(program->instructions);
+    free(program->index_at);
+    free(program->code);
+}
+
+static bool program_decode(const Chunk *chunk, DecodedChunk *program) {
+    program->count = 0;
+    program->code_count = chunk->count;
+    program->instructions = (Instruction *)checked_calloc((size_t)chunk->count, sizeof(Instruction));
+    program->index_at = (int *)checked_calloc((size_t)chunk->count + 1, sizeof(int));
+    program->code = (uint8_t *)checked_calloc((size_t)chunk->count, sizeof(uint8_t));
+    memcpy(program->code, chunk->code, (size_t)chunk->count);
+
+    for (int i = 0; i <= chunk->count; ++i) {
+        program->index_at[i] = -1;
+    }
+    int offset = 0;
+    while (offset < chunk->count) {
+        Instruction *instruction = &program->instructions[program->count];
+        if (!decode_instruction(program->code, chunk->count, offset, instruction)) {
+            return false;
+        }
+        instruction->line = chunk_get_line(chunk, offset);
+        program->index_at[offset] = program->count++;
+        offset += instruction->length;
+    }
+    program->index_at[chunk->count] = program->count;
+
+    for (int i = 0; i < program->count; ++i) {
+        int target = program->instructions[i].target;
+        if (target >= 0 || is_jump(program->instructions[i].opcode)) {
+            if (target < 0 || target > chunk->count || program->index_at[target] < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static Instruction *instruction_at(DecodedChunk *program, int offset) {
+    int index = program->index_at[offset];
+    return index < program->count ? &program->instructions[index] : NULL;
+}
+
+static void mark_reachable(DecodedChunk *program) {
+    if (program->count == 0) {
+        return;
+    }
+    int *worklist = (int *)checked_calloc((size_t)program->count, sizeof(int));
+    int pending = 0;
+    program->instructions[0].reachable = true;
+    worklist[pending++] = 0;
+    while (pending > 0) {
+        int index = worklist[--pending];
+        Instruction *instruction = &program->instructions[index];
+        int successors[2];
+        int successor_count = 0;
+        if (falls_through(instruction->opcode) && index + 1 < program->count) {
+            successors[successor_count++] = index + 1;
+        }
+        if (instruction->target >= 0) {
+            Instruction *target = instruction_at(program, instruction->target);
+            if (target) {
+                target->is_target = true;
+                successors[successor_count++] = program->index_at[instruction->target];
+            }
+        }
+        for (int i = 0; i < successor_count; ++i) {
+            Instruction *successor = &program->instructions[successors[i]];
+            if (!successor->reachable) {
+                successor->reachable = true;
+                worklist[pending++] = successors[i];
+            }
+        }
+    }
+    free(worklist);
+}
+
+/* Backward dataflow to a fixed point: live_in = use | (live_out - dest). */
+static void compute_liveness(DecodedChunk *program) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int index = program->count - 1; index >= 0; --index) {
+            Instruction *instruction = &program->instructions[index];
+            if (!instruction->reachable) {
+                continue;
+            }
+            RegisterSet out = {{0, 0, 0, 0}};
+            if (falls_through(instruction->opcode) && index + 1 < program->count) {
+                out = program->instructions[index + 1].live_in;
+            }
+            if (instruction->target >= 0) {
+                Instruction *target = instruction_at(program, instruction->target);
+                if (target) {
+                    for (int i = 0; i < 4; ++i) {
+                        out.bits[i] |= target->live_in.bits[i];
+                    }
+                }
+            }
+            RegisterSet in = out;
+            if (instruction->dest >= 0) {
+                in.bits[instruction->dest >> 6] &= ~(UINT64_C(1) << (instruction->dest & 63));
+            }
+            for (int i = 0; i < 4; ++i) {
+                in.bits[i] |= instruction->use.bits[i];
+            }
+            if (memcmp(&in, &instruction->live_in, sizeof(in)) != 0) {
+                instruction->live_in = in;
+                changed = true;
+            }
+            instruction->live_out = out;
+        }
+    }
+}
+
+static void write_short(uint8_t *code, int offset, int value) {
+    code[offset] = (uint8_t)((value >> 8) & 0xFF);
+    code[offset + 1] = (uint8_t)(value & 0xFF);
+}
+
+/*
+ * Follows JUMP (and, for unconditional jumps, LOOP) chains from the jump's
+ * destination. Returns true if the instruction was retargeted or rewritten.
+ */
+static bool thread_jump(DecodedChunk *program, Instruction *instruction) {
+    bool unconditional = is_unconditional_jump(instruction->opcode);
+    int target = instruction->target;
+    for (int hops = 0; hops < PEEPHOLE_MAX_HOPS; ++hops) {
+        Instruction *next = instruction_at(program, target);
+        if (!next || next == instruction) {
+            break;
+        }
+        if (next->opcode == OP_JUMP || (unconditional && next->opcode == OP_LOOP)) {
+            target = next->target;
+            continue;
+        }
+        if (unconditional && next->opcode == OP_RETURN) {
+            uint8_t *at = program->code + instruction->offset;
+            at[0] = OP_RETURN;
+            at[1] = program->code[next->offset + 1];
+            instruction->opcode = OP_RETURN;
+            instruction->length = 2;
+            instruction->target = -1;
+            return true;
+        }
+        break;
+    }
+    if (target == instruction->target) {
+        return false;
+    }
+
+    int end = instruction->offset + instruction->length;
+    if (target >= end) {
+        if (target - end > UINT16_MAX) {
+            return false;
+        }
+        if (instruction->opcode == OP_LOOP) {
+            program->code[instruction->offset] = OP_JUMP;
+            instruction->opcode = OP_JUMP;
+        }
+    } else {
+        if (!unconditional || end - target > UINT16_MAX) {
+            return false;
+        }
+        program->code[instruction->offset] = OP_LOOP;
+        instruction->opcode = OP_LOOP;
+    }
+    instruction->target = target;
+    return true;
+}
+
+static bool optimize_round(DecodedChunk *program) {
+    bool changed = false;
+    for (int index = 0; index < program->count; ++index) {
+        Instruction *instruction = &program->instructions[index];
+        if (!instruction->reachable) {
+            instruction->removed = true;
+            changed = true;
+            continue;
+        }
+        const uint8_t *at = program->code + instruction->offset;
+        if (instruction->opcode == OP_MOVE && at[1] == at[2]) {
+            instruction->removed = true;
+        } else if (is_pure(instruction->opcode) && !set_contains(&instruction->live_out, instruction->dest)) {
+            instruction->removed = true;
+        } else if (instruction->target >= 0) {
+            changed |= thread_jump(program, instruction);
+            bool no_effect = instruction->opcode == OP_JUMP || instruction->opcode == OP_JUMP_IF_FALSE ||
+                             instruction->opcode == OP_JUMP_IF_TRUE;
+            if (no_effect && instruction->target == instruction->offset + instruction->length) {
+                instruction->removed = true;
+            }
+        }
+        changed |= instruction->removed;
+    }
+
+    /* NOT t, x; JUMP_IF_FALSE t  =>  JUMP_IF_TRUE x, when nothing else reads t. */
+    for (int index = 0; index + 1 < program->count; ++index) {
+        Instruction *negate = &program->instructions[index];
+        Instruction *branch = &program->instructions[index + 1];
+        if (negate->removed || branch->removed || negate->opcode != OP_NOT || branch->is_target) {
+            continue;
+        }
+        if (branch->opcode != OP_JUMP_IF_FALSE && branch->opcode != OP_JUMP_IF_TRUE) {
+            continue;
+        }
+        uint8_t *branch_code = program->code + branch->offset;
+        int temp = program->code[negate->offset + 1];
+        if (branch_code[1] != temp || set_contains(&branch->live_out, temp)) {
+            continue;
+        }
+        branch->opcode = branch->opcode == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+        branch_code[0] = branch->opcode;
+        branch_code[1] = program->code[negate->offset + 2];
+        negate->removed = true;
+        changed = true;
+    }
+    return changed;
+}
+
+/* Writes the surviving instructions back into `chunk` with patched offsets and lines. */
+static void relayout(DecodedChunk *program, Chunk *chunk) {
+    /* position[i]: new offset of instruction i, or of the next survivor when i was removed. */
+    int *position = (int *)checked_calloc((size_t)program->count + 1, sizeof(int));
+    int size = 0;
+    for (int i = 0; i < program->count; ++i) {
+        if (!program->instructions[i].removed) {
+            size += program->instructions[i].length;
+        }
+    }
+    position[program->count] = size;
+    for (int i = program->count - 1; i >= 0; --i) {
+        const Instruction *instruction = &program->instructions[i];
+        position[i] = instruction->removed ? position[i + 1] : position[i + 1] - instruction->length;
+    }
+
+    chunk->count = 0;
+    chunk->line_count = 0;
+    for (int i = 0; i < program->count; ++i) {
+        const Instruction *instruction = &program->instructions[i];
+        if (instruction->removed) {
+            continue;
+        }
+        uint8_t *at = program->code + instruction->offset;
+        if (instruction->target >= 0) {
+            int end = position[i] + instruction->length;
+            int target = position[program->index_at[instruction->target]];
+            write_short(at, instruction->length - 2, instruction->opcode == OP_LOOP ? end - target : target - end);
+        }
+        for (int byte = 0; byte < instruction->length; ++byte) {
+            chunk_write(chunk, at[byte], instruction->line);
+        }
+    }
+    free(position);
+}
+
+static int count_instructions(const Chunk *chunk) {
+    DecodedChunk program;
+    int count = program_decode(chunk, &program) ? program.count : -1;
+    program_free(&program);
+    return count;
+}
+
+void peephole_optimize(Chunk *chunk, PeepholeStats *stats) {
+    if (!chunk) {
+        return;
+    }
+    if (stats) {
+        stats->instructions_before = count_instructions(chunk);
+        stats->instructions_after = stats->instructions_before;
+    }
+    for (int round = 0; round < PEEPHOLE_MAX_ROUNDS; ++round) {
+        DecodedChunk program;
+        if (!program_decode(chunk, &program)) {
+            program_free(&program);
+            return;
+        }
+        mark_reachable(&program);
+        compute_liveness(&program);
+        bool changed = optimize_round(&program);
+        if (changed) {
+            relayout(&program, chunk);
+        }
+        program_free(&program);
+        if (!changed) {
+            break;
+        }
+    }
+    if (stats) {
+        stats->instructions_after = count_instructions(chunk);
+    }
+}
+
+static bool registers_below(const RegisterSet *set, int limit) {
+    for (int reg = limit < 0 ? 0 : limit; reg <= UINT8_MAX; ++reg) {
+        if (set_contains(set, reg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool instruction_in_bounds(const Chunk *chunk, int register_count, const Instruction *instruction) {
+    if (instruction->dest >= register_count || !registers_below(&instruction->use, register_count)) {
+        return false;
+    }
+    if (instruction->constant >= 0 &&
+        ((size_t)instruction->constant >= chunk->constants.count ||
+         (instruction->constant_is_name && !value_is_string(chunk->constants.values[instruction->constant])))) {
+        return false;
+    }
+    if (instruction->cache >= chunk->cache_count) {
+        return false;
+    }
+    return instruction->target < chunk->count;
+}
+
+bool peephole_verify(const Chunk *chunk, int register_count) {
+    if (!chunk || chunk->count == 0) {
+        return false;
+    }
+    DecodedChunk program;
+    bool ok = program_decode(chunk, &program);
+    for (int i = 0; ok && i < program.count; ++i) {
+        ok = instruction_in_bounds(chunk, register_count, &program.instructions[i]);
+    }
+    /* The interpreter has no end-of-code check, so control must not fall off the end. */
+    ok = ok && !falls_through(program.instructions[program.count - 1].opcode);
+    program_free(&program);
+    return ok;
+}
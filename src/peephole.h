@@ -0,0 +1,30 @@
+#ifndef VIBELANG_PEEPHOLE_H
+#define VIBELANG_PEEPHOLE_H
+
+#include "chunk.h"
+
+/*
+ * Post-compilation clean-up of a finished chunk. The pass drops self moves,
+ * stores to registers that are never read again, jumps to the next
+ * instruction and code that cannot be reached; it threads jumps that land on
+ * another JUMP, LOOP or RETURN and folds `NOT t, x; JUMP_IF_FALSE t` into
+ * `JUMP_IF_TRUE x`. Jump offsets and line runs are rebuilt for the new
+ * layout. A chunk it cannot decode is left untouched.
+ */
+typedef struct {
+    int instructions_before;
+    int instructions_after;
+} PeepholeStats;
+
+/* `stats` may be NULL. */
+void peephole_optimize(Chunk *chunk, PeepholeStats *stats);
+
+/*
+ * Whether every instruction of `chunk` decodes and stays in bounds: registers
+ * below `register_count`, constant and inline cache indices the chunk has
+ * (names being strings), and jumps onto instruction boundaries. Chunks that
+ * come from outside the compiler must pass this before they are run.
+ */
+bool peephole_verify(const Chunk *chunk, int register_count);
+
+#endif
@@ -0,0 +1,53 @@
+#include "shape.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static Shape *allocate_shape(Shape *parent, ObjString *name) {
+    Shape *shape = (Shape *)calloc(1, sizeof(Shape));
+    if (!shape) {
+        fprintf(stderr, "Failed to allocate shape.\n");
+        exit(EXIT_FAILURE);
+    }
+    shape->parent = parent;
+    shape->name = name;
+    shape->slot_count = parent ? parent->slot_count + 1 : 0;
+    return shape;
+}
+
+Shape *shape_new_root(void) {
+    return allocate_shape(NULL, NULL);
+}
+
+Shape *shape_transition(Shape *shape, ObjString *name) {
+    for (size_t i = 0; i < shape->transition_count; ++i) {
+        Shape *child = shape->transitions[i];
+        if (child->name == name) {
+            return child;
+        }
+    }
+    if (shape->transition_count == shape->transition_capacity) {
+        size_t new_capacity = shape->transition_capacity < 4 ? 4 : shape->transition_capacity * 2;
+        Shape **transitions = (Shape **)realloc(shape->transitions, new_capacity * sizeof(Shape *));
+        if (!transitions) {
+            fprintf(stderr, "Failed to grow shape transitions.\n");
+            exit(EXIT_FAILURE);
+        }
+        shape->transitions = transitions;
+        shape->transition_capacity = new_capacity;
+    }
+    Shape *child = allocate_shape(shape, name);
+    shape->transitions[shape->transition_count++] = child;
+    return child;
+}
+
+void shape_free_tree(Shape *root) {
+    if (!root) {
+        return;
+    }
+    for (size_t i = 0; i < root->transition_count; ++i) {
+        shape_free_tree(root->transitions[i]);
+    }
+    free(root->transitions);
+    free(root);
+}
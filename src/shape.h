@@ -0,0 +1,39 @@
+#ifndef VIBELANG_SHAPE_H
+#define VIBELANG_SHAPE_H
+
+#include <stddef.h>
+
+#include "value.h"
+
+/*
+ * Hidden class describing the field layout of an instance. Shapes form a
+ * transition tree rooted at the VM's empty shape: adding field `name` to an
+ * instance of shape S moves it to S's child for `name`, so instances that
+ * gained the same fields in the same order share one shape and keep their
+ * values in the same slot indices. Each shape records only the field it adds,
+ * in slot `slot_count - 1`; earlier slots are named by its ancestors. Shapes
+ * are owned by the VM, not the GC.
+ */
+typedef struct Shape {
+    struct Shape *parent;
+    ObjString *name;
+    size_t slot_count;
+    struct Shape **transitions;
+    size_t transition_count;
+    size_t transition_capacity;
+} Shape;
+
+Shape *shape_new_root(void);
+Shape *shape_transition(Shape *shape, ObjString *name);
+void shape_free_tree(Shape *root);
+
+static inline int shape_find_slot(const Shape *shape, const ObjString *name) {
+    for (; shape->parent; shape = shape->parent) {
+        if (shape->name == name) {
+            return (int)shape->slot_count - 1;
+        }
+    }
+    return -1;
+}
+
+#endif
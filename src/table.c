@@ -4,40 +4,81 @@
 #include <stdlib.h>
 #include <string.h>
 
-static bool ensure_capacity(Table *table, size_t required) {
-    if (required <= table->capacity) {
+#define TABLE_MAX_LOAD_NUMERATOR 3
+#define TABLE_MAX_LOAD_DENOMINATOR 4
+
+static ObjString tombstone_sentinel;
+
+#define TOMBSTONE (&tombstone_sentinel)
+
+static bool string_equals(const ObjString *string, const char *chars, size_t length, uint32_t hash) {
+    if (!string) {
+        return false;
+    }
+    if (string->hash != hash || string->length != length) {
+        return false;
+    }
+    if (length == 0) {
         return true;
     }
-    size_t new_capacity = table->capacity == 0 ? 8 : table->capacity;
-    while (new_capacity < required) {
-        new_capacity *= 2;
-        if (new_capacity < table->capacity) {
-            return false;
+    return memcmp(string->chars, chars, length) == 0;
+}
+
+static ObjString **find_slot(ObjString **keys, size_t capacity, const char *chars, size_t length, uint32_t hash) {
+    size_t mask = capacity - 1;
+    size_t index = (size_t)hash & mask;
+    ObjString **tombstone = NULL;
+    for (;;) {
+        ObjString **slot = &keys[index];
+        ObjString *entry = *slot;
+        if (!entry) {
+            return tombstone ? tombstone : slot;
+        }
+        if (entry == TOMBSTONE) {
+            if (!tombstone) {
+                tombstone = slot;
+            }
+        } else if (string_equals(entry, chars, length, hash)) {
+            return slot;
         }
+        index = (index + 1) & mask;
     }
-    ObjString **keys = (ObjString **)realloc(table->keys, new_capacity * sizeof(ObjString *));
+}
+
+static bool adjust_capacity(Table *table, size_t new_capacity) {
+    ObjString **keys = (ObjString **)calloc(new_capacity, sizeof(ObjString *));
     if (!keys) {
         return false;
     }
-    for (size_t i = table->capacity; i < new_capacity; ++i) {
-        keys[i] = NULL;
+    size_t count = 0;
+    for (size_t i = 0; i < table->capacity; ++i) {
+        ObjString *entry = table->keys[i];
+        if (!entry || entry == TOMBSTONE) {
+            continue;
+        }
+        ObjString **slot = find_slot(keys, new_capacity, entry->chars, entry->length, entry->hash);
+        *slot = entry;
+        count++;
     }
+    free(table->keys);
     table->keys = keys;
     table->capacity = new_capacity;
+    table->count = count;
     return true;
 }
 
-static bool string_equals(const ObjString *string, const char *chars, size_t length, uint32_t hash) {
-    if (!string) {
-        return false;
-    }
-    if (string->hash != hash || string->length != length) {
-        return false;
-    }
-    if (length == 0) {
+static bool ensure_capacity(Table *table, size_t required) {
+    if (required * TABLE_MAX_LOAD_DENOMINATOR <= table->capacity * TABLE_MAX_LOAD_NUMERATOR) {
         return true;
     }
-    return memcmp(string->chars, chars, length) == 0;
+    size_t new_capacity = table->capacity == 0 ? 8 : table->capacity * 2;
+    while (required * TABLE_MAX_LOAD_DENOMINATOR > new_capacity * TABLE_MAX_LOAD_NUMERATOR) {
+        new_capacity *= 2;
+        if (new_capacity < table->capacity) {
+            return false;
+        }
+    }
+    return adjust_capacity(table, new_capacity);
 }
 
 void table_init(Table *table) {
@@ -63,39 +104,75 @@ void table_define(Table *table, ObjString *key) {
     if (!table || !key) {
         return;
     }
-    if (table_find_string(table, key->chars, key->length, key->hash)) {
-        return;
-    }
     if (!ensure_capacity(table, table->count + 1)) {
         fprintf(stderr, "Failed to grow intern table.\n");
         exit(EXIT_FAILURE);
     }
-    table->keys[table->count++] = key;
+    ObjString **slot = find_slot(table->keys, table->capacity, key->chars, key->length, key->hash);
+    if (*slot && *slot != TOMBSTONE) {
+        return;
+    }
+    if (!*slot) {
+        table->count++;
+    }
+    *slot = key;
 }
 
 ObjString *table_find_string(Table *table, const char *chars, size_t length, uint32_t hash) {
-    if (!table) {
+    if (!table || table->capacity == 0) {
         return NULL;
     }
-    for (size_t i = 0; i < table->count; ++i) {
-        ObjString *entry = table->keys[i];
-        if (string_equals(entry, chars, length, hash)) {
+    ObjString *entry = *find_slot(table->keys, table->capacity, chars, length, hash);
+    if (!entry || entry == TOMBSTONE) {
+        return NULL;
+    }
+    return entry;
+}
+
+ObjString *table_find_concat(Table *table, const ObjString *a, const ObjString *b, uint32_t hash) {
+    if (!table || table->capacity == 0) {
+        return NULL;
+    }
+    size_t length = a->length + b->length;
+    size_t mask = table->capacity - 1;
+    for (size_t index = (size_t)hash & mask;; index = (index + 1) & mask) {
+        ObjString *entry = table->keys[index];
+        if (!entry) {
+            return NULL;
+        }
+        if (entry != TOMBSTONE && entry->hash == hash && entry->length == length &&
+            memcmp(entry->chars, a->chars, a->length) == 0 &&
+            memcmp(entry->chars + a->length, b->chars, b->length) == 0) {
             return entry;
         }
     }
-    return NULL;
 }
 
-void table_remove_white(Table *table) {
+void table_remove(Table *table, const ObjString *key) {
+    if (!table || !key || table->capacity == 0) {
+        return;
+    }
+    size_t mask = table->capacity - 1;
+    for (size_t index = (size_t)key->hash & mask;; index = (index + 1) & mask) {
+        ObjString *entry = table->keys[index];
+        if (!entry) {
+            return;
+        }
+        if (entry == key) {
+            table->keys[index] = TOMBSTONE;
+            return;
+        }
+    }
+}
+
+void table_remove_white(Table *table, uint8_t epoch) {
     if (!table) {
         return;
     }
-    size_t write_index = 0;
-    for (size_t i = 0; i < table->count; ++i) {
+    for (size_t i = 0; i < table->capacity; ++i) {
         ObjString *entry = table->keys[i];
-        if (entry && entry->obj.marked) {
-            table->keys[write_index++] = entry;
+        if (entry && entry != TOMBSTONE && entry->obj.mark != epoch) {
+            table->keys[i] = TOMBSTONE;
         }
     }
-    table->count = write_index;
 }
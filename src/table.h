@@ -6,6 +6,11 @@
 
 #include "object.h"
 
+/*
+ * Open-addressed set of interned strings keyed by ObjString.hash. The capacity
+ * is always a power of two and `count` includes tombstones left behind by
+ * table_remove_white.
+ */
 typedef struct {
     ObjString **keys;
     size_t count;
@@ -16,7 +21,11 @@ void table_init(Table *table);
 void table_free(Table *table);
 void table_define(Table *table, ObjString *key);
 ObjString *table_find_string(Table *table, const char *chars, size_t length, uint32_t hash);
-void table_remove_white(Table *table);
-
+/* The interned string equal to `a` followed by `b`, found without building it. */
+ObjString *table_find_concat(Table *table, const ObjString *a, const ObjString *b, uint32_t hash);
+/* Drops `key` itself, leaving a tombstone; a string that is not in the table is ignored. */
+void table_remove(Table *table, const ObjString *key);
+/* Drops every string whose mark is not `epoch`. */
+void table_remove_white(Table *table, uint8_t epoch);
 
 #endif
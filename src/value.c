@@ -15,39 +15,35 @@ static size_t grow_capacity(size_t capacity) {
 }
 
 bool value_equals(Value a, Value b) {
-    if (a.type != b.type) {
-        return false;
+    if (value_is_number(a) && value_is_number(b)) {
+        return value_as_number(a) == value_as_number(b);
     }
-    switch (a.type) {
-        case VAL_NULL:
+    if (value_is_string(a) && value_is_string(b)) {
+        ObjString *string_a = value_as_string(a);
+        ObjString *string_b = value_as_string(b);
+        if (string_a == string_b) {
             return true;
-        case VAL_BOOL:
-            return a.as.boolean == b.as.boolean;
-        case VAL_NUMBER:
-            return a.as.number == b.as.number;
-        case VAL_OBJ:
-            if (value_is_string(a) && value_is_string(b)) {
-                ObjString *string_a = value_as_string(a);
-                ObjString *string_b = value_as_string(b);
-                if (string_a == string_b) {
-                    return true;
-                }
-                if (string_a->length != string_b->length) {
-                    return false;
-                }
-                return memcmp(string_a->chars, string_b->chars, string_a->length) == 0;
-            }
-            return value_as_obj(a) == value_as_obj(b);
+        }
+        if (string_a->length != string_b->length) {
+            return false;
+        }
+        return memcmp(string_a->chars, string_b->chars, string_a->length) == 0;
+    }
+    if (value_is_obj(a) && value_is_obj(b)) {
+        return value_as_obj(a) == value_as_obj(b);
+    }
+    if (value_is_bool(a) && value_is_bool(b)) {
+        return value_as_bool(a) == value_as_bool(b);
     }
-    return false;
+    return value_is_null(a) && value_is_null(b);
 }
 
 bool value_is_truthy(Value value) {
-    if (value.type == VAL_NULL) {
+    if (value_is_null(value)) {
         return false;
     }
-    if (value.type == VAL_BOOL) {
-        return value.as.boolean;
+    if (value_is_bool(value)) {
+        return value_as_bool(value);
     }
     return true;
 }
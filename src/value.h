@@ -8,6 +8,83 @@ typedef struct Obj Obj;
 typedef struct ObjFunction ObjFunction;
 typedef struct ObjString ObjString;
 
+#ifdef VIBELANG_NAN_BOXING
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * NaN-boxed representation: every value fits in one 64-bit word. Numbers are
+ * stored as plain doubles. Everything else lives inside the quiet-NaN space,
+ * which arithmetic never produces: singletons are tagged in the low bits and
+ * object pointers (48-bit) are marked by the sign bit.
+ */
+typedef struct {
+    uint64_t bits;
+} Value;
+
+#define VALUE_SIGN_BIT ((uint64_t)0x8000000000000000)
+#define VALUE_QNAN ((uint64_t)0x7ffc000000000000)
+#define VALUE_TAG_NULL 1
+#define VALUE_TAG_FALSE 2
+#define VALUE_TAG_TRUE 3
+
+static inline Value value_from_bits(uint64_t bits) {
+    Value value;
+    value.bits = bits;
+    return value;
+}
+
+static inline Value value_make_null(void) {
+    return value_from_bits(VALUE_QNAN | VALUE_TAG_NULL);
+}
+
+static inline Value value_make_bool(bool boolean) {
+    return value_from_bits(VALUE_QNAN | (boolean ? VALUE_TAG_TRUE : VALUE_TAG_FALSE));
+}
+
+static inline Value value_make_number(double number) {
+    Value value;
+    memcpy(&value.bits, &number, sizeof(number));
+    return value;
+}
+
+static inline Value value_make_obj(Obj *object) {
+    return value_from_bits(VALUE_SIGN_BIT | VALUE_QNAN | (uint64_t)(uintptr_t)object);
+}
+
+static inline bool value_is_null(Value value) {
+    return value.bits == (VALUE_QNAN | VALUE_TAG_NULL);
+}
+
+static inline bool value_is_bool(Value value) {
+    return (value.bits | 1) == (VALUE_QNAN | VALUE_TAG_TRUE);
+}
+
+static inline bool value_is_number(Value value) {
+    return (value.bits & VALUE_QNAN) != VALUE_QNAN;
+}
+
+static inline bool value_is_obj(Value value) {
+    return (value.bits & (VALUE_QNAN | VALUE_SIGN_BIT)) == (VALUE_QNAN | VALUE_SIGN_BIT);
+}
+
+static inline bool value_as_bool(Value value) {
+    return value.bits == (VALUE_QNAN | VALUE_TAG_TRUE);
+}
+
+static inline double value_as_number(Value value) {
+    double number;
+    memcpy(&number, &value.bits, sizeof(number));
+    return number;
+}
+
+static inline Obj *value_as_obj(Value value) {
+    return (Obj *)(uintptr_t)(value.bits & ~(VALUE_SIGN_BIT | VALUE_QNAN));
+}
+
+#else
+
 typedef enum {
     VAL_NULL,
     VAL_BOOL,
@@ -79,6 +156,8 @@ static inline Obj *value_as_obj(Value value) {
     return value.as.obj;
 }
 
+#endif
+
 bool value_equals(Value a, Value b);
 bool value_is_truthy(Value value);
 
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "vm.h"
 
 #include <stdint.h>
@@ -5,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 
 #define INITIAL_STACK_CAPACITY 256
 #define INITIAL_FRAME_CAPACITY 64
@@ -12,17 +15,17 @@
 static void vm_reset_stack(VM *vm);
 static void runtime_error(VM *vm, const char *message);
 static bool call_value(VM *vm, CallFrame *caller, uint8_t dest_reg, Value callee, uint8_t arg_count, const uint8_t *arg_registers);
-static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint8_t dest_reg, uint8_t arg_count, const uint8_t *arg_registers);
+static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint8_t dest_reg, const Value *receiver, uint8_t arg_count, const uint8_t *arg_registers);
 static InterpretResult run(VM *vm, Value *result_out);
 static bool ensure_globals_capacity(VM *vm, size_t required);
 static bool concatenate(VM *vm, Value *dest, Value left, Value right);
 static void mark_roots(VM *vm);
+static void mark_shape_names(VM *vm, const Shape *shape);
 static void mark_value(VM *vm, Value value);
 static void mark_object(VM *vm, Obj *object);
 static void trace_references(VM *vm);
-static void blacken_object(VM *vm, Obj *object);
+static size_t blacken_object(VM *vm, Obj *object);
 static void mark_array(VM *vm, ValueArray *array);
-static void sweep(VM *vm);
 
 static bool ensure_stack_capacity(VM *vm, int additional_slots) {
     int current_count = (int)(vm->stack_top - vm->stack);
@@ -42,6 +45,15 @@ static bool ensure_stack_capacity(VM *vm, int additional_slots) {
         return false;
     }
     int offset = (int)(vm->stack_top - vm->stack);
+    if (new_stack != vm->stack) {
+        for (int i = 0; i < vm->frame_count; ++i) {
+            CallFrame *frame = &vm->frames[i];
+            frame->registers = new_stack + (frame->registers - vm->stack);
+            if (frame->caller_registers) {
+                frame->caller_registers = new_stack + (frame->caller_registers - vm->stack);
+            }
+        }
+    }
     vm->stack = new_stack;
     vm->stack_capacity = new_capacity;
     vm->stack_top = vm->stack + offset;
@@ -97,18 +109,55 @@ static void mark_array(VM *vm, ValueArray *array) {
     }
 }
 
-static void mark_roots(VM *vm) {
+static void mark_shape_names(VM *vm, const Shape *shape) {
+    if (shape->name) {
+        mark_object(vm, (Obj *)shape->name);
+    }
+    for (size_t i = 0; i < shape->transition_count; ++i) {
+        mark_shape_names(vm, shape->transitions[i]);
+    }
+}
+
+/* Roots that are written without barriers: the register stack, the running functions and the well-known names. */
+static void mark_stack_roots(VM *vm) {
     for (Value *slot = vm->stack; slot && slot < vm->stack_top; ++slot) {
         mark_value(vm, *slot);
     }
     for (int i = 0; i < vm->frame_count; ++i) {
         mark_object(vm, (Obj *)vm->frames[i].function);
     }
+    for (int i = 0; i < VM_NAME_COUNT; ++i) {
+        mark_object(vm, (Obj *)vm->names[i]);
+    }
+}
+
+static void mark_roots(VM *vm) {
+    mark_stack_roots(vm);
     for (size_t i = 0; i < vm->global_count; ++i) {
         if (vm->global_defined[i]) {
             mark_value(vm, vm->globals[i]);
         }
     }
+    if (vm->root_shape) {
+        mark_shape_names(vm, vm->root_shape);
+    }
+}
+
+static void reset_dirty_globals(VM *vm) {
+    vm->globals_dirty_from = SIZE_MAX;
+    vm->globals_dirty_to = 0;
+}
+
+static void write_global(VM *vm, size_t slot, Value value) {
+    vm->globals[slot] = value;
+    if (value_is_obj(value) && obj_is_young(value_as_obj(value))) {
+        if (slot < vm->globals_dirty_from) {
+            vm->globals_dirty_from = slot;
+        }
+        if (slot >= vm->globals_dirty_to) {
+            vm->globals_dirty_to = slot + 1;
+        }
+    }
 }
 
 static void trace_references(VM *vm) {
@@ -118,7 +167,9 @@ static void trace_references(VM *vm) {
     }
 }
 
-static void blacken_object(VM *vm, Obj *object) {
+/* Returns the work done, one unit for the object plus one per reference scanned. */
+static size_t blacken_object(VM *vm, Obj *object) {
+    size_t work = 1;
     switch (object->type) {
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction *)object;
@@ -126,6 +177,12 @@ static void blacken_object(VM *vm, Obj *object) {
                 mark_object(vm, (Obj *)function->name);
             }
             mark_array(vm, &function->chunk.constants);
+            work += function->chunk.constants.count + (size_t)function->chunk.cache_count * INLINE_CACHE_ENTRIES;
+            for (int i = 0; i < function->chunk.cache_count; ++i) {
+                for (int j = 0; j < INLINE_CACHE_ENTRIES; ++j) {
+                    mark_object(vm, (Obj *)function->chunk.caches[i].entries[j].klass);
+                }
+            }
             break;
         }
         case OBJ_STRING:
@@ -135,6 +192,7 @@ static void blacken_object(VM *vm, Obj *object) {
             for (size_t i = 0; i < array->elements.count; ++i) {
                 mark_value(vm, array->elements.values[i]);
             }
+            work += array->elements.count;
             break;
         }
         case OBJ_CLASS: {
@@ -142,12 +200,14 @@ static void blacken_object(VM *vm, Obj *object) {
             if (klass->name) {
                 mark_object(vm, (Obj *)klass->name);
             }
+            mark_object(vm, (Obj *)klass->constructor);
             for (size_t i = 0; i < klass->method_count; ++i) {
                 if (klass->methods[i].name) {
                     mark_object(vm, (Obj *)klass->methods[i].name);
                 }
                 mark_value(vm, klass->methods[i].value);
             }
+            work += klass->method_count * 2;
             break;
         }
         case OBJ_INSTANCE: {
@@ -155,12 +215,10 @@ static void blacken_object(VM *vm, Obj *object) {
             if (instance->klass) {
                 mark_object(vm, (Obj *)instance->klass);
             }
-            for (size_t i = 0; i < instance->field_count; ++i) {
-                if (instance->fields[i].name) {
-                    mark_object(vm, (Obj *)instance->fields[i].name);
-                }
-                mark_value(vm, instance->fields[i].value);
+            for (size_t i = 0; i < instance->shape->slot_count; ++i) {
+                mark_value(vm, instance->slots[i]);
             }
+            work += instance->shape->slot_count;
             break;
         }
         case OBJ_BOUND_METHOD: {
@@ -172,34 +230,22 @@ static void blacken_object(VM *vm, Obj *object) {
             break;
         }
     }
+    return work;
 }
 
-static void sweep(VM *vm) {
-    Obj *previous = NULL;
-    Obj *object = vm->objects;
-    while (object) {
-        if (object->marked) {
-            object->marked = false;
-            previous = object;
-            object = object->next;
-            continue;
-        }
-        Obj *unreached = object;
-        object = object->next;
-        if (previous) {
-            previous->next = object;
-        } else {
-            vm->objects = object;
-        }
-        obj_free(vm, unreached);
+/* Once the nursery is empty no old object can point at a young one. */
+static void reset_remembered_set(VM *vm) {
+    for (int i = 0; i < vm->remembered_count; ++i) {
+        vm->remembered[i]->remembered = false;
     }
+    vm->remembered_count = 0;
 }
 
 static void mark_object(VM *vm, Obj *object) {
-    if (!object || object->marked) {
+    if (!object || object->mark == vm->gc_epoch) {
         return;
     }
-    object->marked = true;
+    object->mark = vm->gc_epoch;
     if (vm->gray_count + 1 > vm->gray_capacity) {
         int old_capacity = vm->gray_capacity;
         vm->gray_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
@@ -213,16 +259,278 @@ static void mark_object(VM *vm, Obj *object) {
     vm->gray_stack[vm->gray_count++] = object;
 }
 
-void vm_collect_garbage(VM *vm) {
-    if (!vm) {
+void vm_remember(VM *vm, Obj *owner) {
+    if (!vm || !owner || owner->remembered) {
+        return;
+    }
+    if (vm->remembered_count + 1 > vm->remembered_capacity) {
+        int old_capacity = vm->remembered_capacity;
+        vm->remembered_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        Obj **remembered = (Obj **)realloc(vm->remembered, (size_t)vm->remembered_capacity * sizeof(Obj *));
+        if (!remembered) {
+            fprintf(stderr, "Failed to grow GC remembered set.\n");
+            exit(EXIT_FAILURE);
+        }
+        vm->remembered = remembered;
+    }
+    owner->remembered = true;
+    vm->remembered[vm->remembered_count++] = owner;
+}
+
+static uint64_t gc_clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t record_pause(VM *vm, uint64_t start) {
+    uint64_t pause = gc_clock_ns() - start;
+    vm->gc_pause_ns += pause;
+    if (pause > vm->gc_max_pause_ns) {
+        vm->gc_max_pause_ns = pause;
+    }
+    return pause;
+}
+
+Shape *vm_shape_transition(VM *vm, Shape *shape, ObjString *name) {
+    /*
+     * Shapes are not traced by minor collections, so a young name is
+     * promoted on the spot; full collections mark every name in the tree.
+     */
+    if (obj_is_young(&name->obj)) {
+        name->obj.mark = vm->gc_epoch;
+    }
+    return shape_transition(shape, name);
+}
+
+/* Survivors of the nursery already carry the old generation's mark and stay where they are. */
+static void free_if_unmarked(VM *vm, Obj *object) {
+    if (object->mark != vm->gc_epoch) {
+        obj_free(vm, object);
+    }
+}
+
+void vm_write_barrier_slow(VM *vm, Obj *owner, Obj *target) {
+    if (vm->gc_phase == GC_PHASE_MARKING) {
+        /* The cycle ends with an empty nursery, so only the tri-colour invariant matters here. */
+        if (owner->mark == vm->gc_epoch) {
+            mark_object(vm, target);
+        }
+        return;
+    }
+    if (obj_is_young(target) && !owner->remembered) {
+        vm_remember(vm, owner);
+    }
+}
+
+void vm_collect_nursery(VM *vm) {
+    if (!vm || vm->gc_phase == GC_PHASE_MARKING) {
         return;
     }
+    uint64_t start = gc_clock_ns();
+    /*
+     * Old objects carry the current epoch, so marking stops at the generation
+     * boundary. While a cycle is sweeping, the old objects it has yet to free
+     * are unreachable and never visited. Globals and the shape tree are
+     * scanned only where a young object may have been stored since.
+     */
+    mark_stack_roots(vm);
+    size_t dirty_to = vm->globals_dirty_to < vm->global_count ? vm->globals_dirty_to : vm->global_count;
+    for (size_t i = vm->globals_dirty_from; i < dirty_to; ++i) {
+        if (vm->global_defined[i]) {
+            mark_value(vm, vm->globals[i]);
+        }
+    }
+    for (int i = 0; i < vm->remembered_count; ++i) {
+        Obj *object = vm->remembered[i];
+        if (object->type == OBJ_ARRAY) {
+            ObjArray *array = (ObjArray *)object;
+            for (size_t j = array->dirty_from; j < array->elements.count; ++j) {
+                mark_value(vm, array->elements.values[j]);
+            }
+        } else {
+            blacken_object(vm, object);
+        }
+    }
+    trace_references(vm);
+    Obj *object = vm->young_objects;
+    vm->young_objects = NULL;
+    while (object) {
+        Obj *next = object->next;
+        if (object->mark != vm->gc_epoch) {
+            /* Only young strings can have died, so the intern table is not scanned as a whole. */
+            if (object->type == OBJ_STRING) {
+                table_remove(&vm->strings, (ObjString *)object);
+            }
+            obj_free(vm, object);
+        }
+        object = next;
+    }
+    reset_remembered_set(vm);
+    reset_dirty_globals(vm);
+    vm->bytes_at_last_gc = vm->bytes_allocated;
+    vm->gc_minor_collections++;
+    uint64_t pause = record_pause(vm, start);
+    if (pause > vm->gc_max_minor_pause_ns) {
+        vm->gc_max_minor_pause_ns = pause;
+    }
+}
+
+/* A new epoch turns every object white; the roots become the first gray objects. */
+static void start_cycle(VM *vm) {
+    vm->gc_epoch = vm->gc_epoch == UINT8_MAX ? 1 : (uint8_t)(vm->gc_epoch + 1);
+    vm->gc_phase = GC_PHASE_MARKING;
+    mark_roots(vm);
+}
+
+/* Returns true once the gray stack is empty. */
+static bool trace_slice(VM *vm, size_t budget) {
+    size_t work = 0;
+    while (vm->gray_count > 0) {
+        if (work >= budget) {
+            return false;
+        }
+        work += blacken_object(vm, vm->gray_stack[--vm->gray_count]);
+    }
+    return true;
+}
+
+/*
+ * Atomic end of marking. Roots are written without barriers, so they are
+ * scanned again before anything white is freed. Every object allocated so
+ * far is on the list being swept, which leaves the nursery empty once
+ * sweeping starts.
+ */
+static void finish_marking(VM *vm) {
     mark_roots(vm);
     trace_references(vm);
-    table_remove_white(&vm->strings);
-    sweep(vm);
-    size_t target = vm->bytes_allocated * 2;
-    vm->next_gc = target < 1024 ? 1024 : target;
+    table_remove_white(&vm->strings, vm->gc_epoch);
+    reset_remembered_set(vm);
+    reset_dirty_globals(vm);
+    heap_sweep_begin(&vm->heap);
+    vm->sweep_young = vm->young_objects;
+    vm->young_objects = NULL;
+    vm->gc_phase = GC_PHASE_SWEEPING;
+}
+
+/*
+ * Frees the unreached part of the swept nursery, then walks the heap page by
+ * page for old objects that missed this cycle's mark. Young objects (mark 0)
+ * are left alone: the dead ones among them were on the swept nursery, the
+ * rest were allocated since marking ended. Returns true once both are done.
+ */
+static bool sweep_slice(VM *vm, size_t budget) {
+    size_t work = 0;
+    while (vm->sweep_young) {
+        if (work++ >= budget) {
+            return false;
+        }
+        Obj *object = vm->sweep_young;
+        vm->sweep_young = object->next;
+        free_if_unmarked(vm, object);
+    }
+    while (work++ < budget) {
+        Obj *object = heap_sweep_next(&vm->heap);
+        if (!object) {
+            return true;
+        }
+        if (!obj_is_young(object) && object->mark != vm->gc_epoch) {
+            obj_free(vm, object);
+        }
+    }
+    return false;
+}
+
+static void finish_cycle(VM *vm) {
+    vm->gc_phase = GC_PHASE_IDLE;
+    size_t target = (size_t)((double)vm->bytes_allocated * vm->gc_heap_grow_factor);
+    vm->next_gc = target < vm->gc_min_heap_size ? vm->gc_min_heap_size : target;
+    vm->bytes_at_last_gc = vm->bytes_allocated;
+    vm->gc_major_collections++;
+}
+
+/*
+ * Advances marking by `budget`. Sweeping is left to later allocations
+ * (vm_allocate_cell); a step taken while sweeping finishes it at once.
+ */
+static void run_cycle_step(VM *vm, size_t budget) {
+    if (vm->gc_phase == GC_PHASE_SWEEPING) {
+        sweep_slice(vm, SIZE_MAX);
+        finish_cycle(vm);
+        return;
+    }
+    if (vm->gc_phase == GC_PHASE_IDLE) {
+        start_cycle(vm);
+    }
+    if (trace_slice(vm, budget)) {
+        finish_marking(vm);
+    }
+}
+
+Obj *vm_allocate_cell(VM *vm, size_t size) {
+    if (vm->gc_phase == GC_PHASE_SWEEPING) {
+        uint64_t start = gc_clock_ns();
+        if (sweep_slice(vm, GC_LAZY_SWEEP_BATCH)) {
+            finish_cycle(vm);
+        }
+        vm->gc_lazy_sweep_ns += gc_clock_ns() - start;
+    }
+    return heap_allocate(&vm->heap, size);
+}
+
+void vm_collect_step(VM *vm) {
+    if (!vm) {
+        return;
+    }
+    size_t budget = vm->gc_slice_budget;
+    /* A heap that doubled past its target means marking cannot keep up; finish the cycle now. */
+    if (budget == 0 || (vm->gc_phase != GC_PHASE_IDLE && vm->bytes_allocated > vm->next_gc * 2)) {
+        budget = SIZE_MAX;
+    }
+    uint64_t start = gc_clock_ns();
+    run_cycle_step(vm, budget);
+    record_pause(vm, start);
+    vm->gc_slices++;
+    vm->gc_next_slice = vm->bytes_allocated + vm->gc_slice_bytes;
+}
+
+void vm_collect_garbage(VM *vm) {
+    if (!vm) {
+        return;
+    }
+    uint64_t start = gc_clock_ns();
+    while (vm->gc_phase != GC_PHASE_IDLE) {
+        run_cycle_step(vm, SIZE_MAX);
+    }
+    do {
+        run_cycle_step(vm, SIZE_MAX);
+    } while (vm->gc_phase != GC_PHASE_IDLE);
+    record_pause(vm, start);
+}
+
+void vm_configure_gc(VM *vm, double heap_grow_factor, size_t min_heap_size) {
+    if (!vm) {
+        return;
+    }
+    vm->gc_heap_grow_factor = heap_grow_factor < 1.0 ? 1.0 : heap_grow_factor;
+    vm->gc_min_heap_size = min_heap_size;
+    size_t target = (size_t)((double)vm->bytes_allocated * vm->gc_heap_grow_factor);
+    vm->next_gc = target < min_heap_size ? min_heap_size : target;
+}
+
+void vm_configure_nursery(VM *vm, size_t nursery_size) {
+    if (!vm) {
+        return;
+    }
+    vm->gc_nursery_size = nursery_size;
+}
+
+void vm_configure_incremental(VM *vm, size_t slice_budget, size_t slice_bytes) {
+    if (!vm) {
+        return;
+    }
+    vm->gc_slice_budget = slice_budget;
+    vm->gc_slice_bytes = slice_bytes;
 }
 
 static bool ensure_frame_capacity(VM *vm, int additional_frames) {
@@ -246,6 +554,10 @@ static bool ensure_frame_capacity(VM *vm, int additional_frames) {
     return true;
 }
 
+static const char *const well_known_names[VM_NAME_COUNT] = {
+    [VM_NAME_CONSTRUCTOR] = "constructor"
+};
+
 void vm_init(VM *vm) {
     if (!vm) {
         return;
@@ -260,13 +572,42 @@ void vm_init(VM *vm) {
     vm->global_defined = NULL;
     vm->global_count = 0;
     vm->global_capacity = 0;
+    reset_dirty_globals(vm);
     table_init(&vm->strings);
-    vm->objects = NULL;
+    for (int i = 0; i < VM_NAME_COUNT; ++i) {
+        vm->names[i] = NULL;
+    }
+    vm->root_shape = shape_new_root();
+    heap_init(&vm->heap);
+    vm->young_objects = NULL;
     vm->bytes_allocated = 0;
-    vm->next_gc = 1024 * 1024;
+    vm->gc_heap_grow_factor = GC_DEFAULT_HEAP_GROW_FACTOR;
+    vm->gc_min_heap_size = GC_DEFAULT_MIN_HEAP_SIZE;
+    vm->next_gc = GC_DEFAULT_MIN_HEAP_SIZE;
+    vm->gc_nursery_size = GC_DEFAULT_NURSERY_SIZE;
+    vm->bytes_at_last_gc = 0;
     vm->gray_stack = NULL;
     vm->gray_count = 0;
     vm->gray_capacity = 0;
+    vm->remembered = NULL;
+    vm->remembered_count = 0;
+    vm->remembered_capacity = 0;
+    vm->gc_phase = GC_PHASE_IDLE;
+    vm->gc_epoch = 1;
+    vm->gc_slice_budget = GC_DEFAULT_SLICE_BUDGET;
+    vm->gc_slice_bytes = GC_DEFAULT_SLICE_BYTES;
+    vm->gc_next_slice = 0;
+    vm->sweep_young = NULL;
+    vm->gc_minor_collections = 0;
+    vm->gc_major_collections = 0;
+    vm->gc_slices = 0;
+    vm->gc_pause_ns = 0;
+    vm->gc_max_pause_ns = 0;
+    vm->gc_max_minor_pause_ns = 0;
+    vm->gc_lazy_sweep_ns = 0;
+    vm->ic_hits = 0;
+    vm->ic_misses = 0;
+    vm->print_peephole_stats = false;
     if (!ensure_stack_capacity(vm, 0)) {
         fprintf(stderr, "Failed to allocate VM stack.\n");
         exit(EXIT_FAILURE);
@@ -276,28 +617,40 @@ void vm_init(VM *vm) {
         fprintf(stderr, "Failed to allocate VM call frames.\n");
         exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < VM_NAME_COUNT; ++i) {
+        vm->names[i] = obj_string_copy(vm, well_known_names[i], strlen(well_known_names[i]));
+    }
 }
 
 void vm_free(VM *vm) {
     if (!vm) {
         return;
     }
-    Obj *object = vm->objects;
-    while (object) {
-        Obj *next = object->next;
-        obj_free(vm, object);
-        object = next;
+    for (Obj *object = heap_first(&vm->heap); object; object = heap_next(&vm->heap, object)) {
+        obj_release(vm, object);
     }
-    vm->objects = NULL;
+    heap_free(&vm->heap);
+    vm->young_objects = NULL;
+    vm->sweep_young = NULL;
+    vm->gc_phase = GC_PHASE_IDLE;
     free(vm->gray_stack);
     vm->gray_stack = NULL;
     vm->gray_count = 0;
     vm->gray_capacity = 0;
+    free(vm->remembered);
+    vm->remembered = NULL;
+    vm->remembered_count = 0;
+    vm->remembered_capacity = 0;
     free(vm->frames);
     free(vm->stack);
     free(vm->globals);
     free(vm->global_defined);
     table_free(&vm->strings);
+    for (int i = 0; i < VM_NAME_COUNT; ++i) {
+        vm->names[i] = NULL;
+    }
+    shape_free_tree(vm->root_shape);
+    vm->root_shape = NULL;
     vm->frames = NULL;
     vm->stack = NULL;
     vm->stack_top = NULL;
@@ -326,7 +679,7 @@ InterpretResult vm_interpret(VM *vm, ObjFunction *function, Value *result_out) {
         return INTERPRET_RUNTIME_ERROR;
     }
     vm_push(vm, value_make_function(function));
-    if (!call_function(vm, NULL, function, 0, 0, NULL)) {
+    if (!call_function(vm, NULL, function, 0, NULL, 0, NULL)) {
         return INTERPRET_RUNTIME_ERROR;
     }
     return run(vm, result_out);
@@ -359,22 +712,24 @@ static void runtime_error(VM *vm, const char *message) {
     for (int i = vm->frame_count - 1; i >= 0; --i) {
         CallFrame *frame = &vm->frames[i];
         ObjFunction *function = frame->function;
-        size_t instruction_index = (size_t)(frame->ip - function->chunk.code);
+        int instruction_index = (int)(frame->ip - function->chunk.code);
         if (instruction_index > 0) {
             instruction_index -= 1;
         }
-        int line = 0;
-        if (instruction_index < (size_t)function->chunk.count) {
-            line = function->chunk.lines[instruction_index];
-        }
-        const char *name = (function->name && function->name->chars) ? function->name->chars : "<script>";
+        int line = chunk_get_line(&function->chunk, instruction_index);
+        const char *name = function->name ? function->name->chars : "<script>";
         fprintf(stderr, "[line %d] in %s\n", line, name);
     }
     vm_reset_stack(vm);
 }
 
-static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint8_t dest_reg, uint8_t arg_count, const uint8_t *arg_registers) {
-    if (function->arity != arg_count) {
+/*
+ * Pushes a frame for `function`. When `receiver` is given it becomes register 0
+ * and the arguments follow it, which is how methods see `this`.
+ */
+static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint8_t dest_reg, const Value *receiver, uint8_t arg_count, const uint8_t *arg_registers) {
+    int receiver_count = receiver ? 1 : 0;
+    if (function->arity != arg_count + receiver_count) {
         runtime_error(vm, "Incorrect number of arguments.");
         return false;
     }
@@ -395,9 +750,12 @@ static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint
     for (int i = 0; i < function->register_count; ++i) {
         registers[i] = value_make_null();
     }
+    if (receiver) {
+        registers[0] = *receiver;
+    }
     if (caller && arg_count > 0) {
         for (uint8_t i = 0; i < arg_count; ++i) {
-            registers[i] = caller->registers[arg_registers[i]];
+            registers[receiver_count + i] = caller->registers[arg_registers[i]];
         }
     }
 
@@ -415,22 +773,12 @@ static bool call_function(VM *vm, CallFrame *caller, ObjFunction *function, uint
 static bool call_value(VM *vm, CallFrame *caller, uint8_t dest_reg, Value callee, uint8_t arg_count, const uint8_t *arg_registers) {
     if (value_is_bound_method(callee)) {
         ObjBoundMethod *bound = value_as_bound_method(callee);
-        ObjFunction *function = bound->method;
-        if ((uint8_t)arg_count != (uint8_t)(function->arity - 1)) {
-            runtime_error(vm, "Incorrect number of arguments.");
-            return false;
-        }
         if (!caller) {
             runtime_error(vm, "Invalid call context.");
             return false;
         }
-        uint8_t extended[UINT8_MAX];
-        extended[0] = dest_reg;
-        for (uint8_t i = 0; i < arg_count; ++i) {
-            extended[i + 1] = arg_registers[i];
-        }
-        caller->registers[dest_reg] = bound->receiver;
-        return call_function(vm, caller, function, dest_reg, (uint8_t)(arg_count + 1), extended);
+        Value receiver = bound->receiver;
+        return call_function(vm, caller, bound->method, dest_reg, &receiver, arg_count, arg_registers);
     }
 
     if (value_is_class(callee)) {
@@ -447,24 +795,8 @@ static bool call_value(VM *vm, CallFrame *caller, uint8_t dest_reg, Value callee
         Value instance_value = value_make_instance(instance);
         caller->registers[dest_reg] = instance_value;
 
-        ObjString *ctor_name = obj_string_copy(vm, "constructor", strlen("constructor"));
-        Value method_value;
-        if (obj_class_find_method(klass, ctor_name, &method_value)) {
-            if (!value_is_function(method_value)) {
-                runtime_error(vm, "Constructor is not callable.");
-                return false;
-            }
-            ObjFunction *function = value_as_function(method_value);
-            if ((uint8_t)(arg_count + 1) != (uint8_t)function->arity) {
-                runtime_error(vm, "Incorrect number of arguments.");
-                return false;
-            }
-            uint8_t extended[UINT8_MAX];
-            extended[0] = dest_reg;
-            for (uint8_t i = 0; i < arg_count; ++i) {
-                extended[i + 1] = arg_registers[i];
-            }
-            return call_function(vm, caller, function, dest_reg, (uint8_t)(arg_count + 1), extended);
+        if (klass->constructor) {
+            return call_function(vm, caller, klass->constructor, dest_reg, &instance_value, arg_count, arg_registers);
         }
         if (arg_count > 0) {
             runtime_error(vm, "Constructor not defined.");
@@ -474,451 +806,912 @@ static bool call_value(VM *vm, CallFrame *caller, uint8_t dest_reg, Value callee
     }
 
     if (value_is_function(callee)) {
-        return call_function(vm, caller, value_as_function(callee), dest_reg, arg_count, arg_registers);
+        return call_function(vm, caller, value_as_function(callee), dest_reg, NULL, arg_count, arg_registers);
     }
     runtime_error(vm, "Attempted to call a non-function value.");
     return false;
 }
 
+static inline InlineCacheEntry *inline_cache_find(InlineCache *cache, const Shape *shape, const ObjClass *klass) {
+    for (int i = 0; i < INLINE_CACHE_ENTRIES; ++i) {
+        InlineCacheEntry *entry = &cache->entries[i];
+        if (entry->kind != IC_EMPTY && entry->shape == shape && (!entry->klass || entry->klass == klass)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static InlineCacheEntry *inline_cache_store(InlineCache *cache, InlineCacheKind kind, const Shape *shape, ObjClass *klass, uint32_t index, Shape *transition) {
+    InlineCacheEntry *entry = NULL;
+    for (int i = 0; i < INLINE_CACHE_ENTRIES; ++i) {
+        if (cache->entries[i].kind == IC_EMPTY) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+    if (!entry) {
+        entry = &cache->entries[cache->next_victim];
+        cache->next_victim = (uint8_t)((cache->next_victim + 1) % INLINE_CACHE_ENTRIES);
+    }
+    entry->kind = kind;
+    entry->index = index;
+    entry->shape = shape;
+    entry->klass = klass;
+    entry->transition = transition;
+    return entry;
+}
+
+static bool find_method_index(const ObjClass *klass, const ObjString *name, uint32_t *index_out) {
+    for (size_t i = 0; i < klass->method_count; ++i) {
+        if (klass->methods[i].name == name) {
+            *index_out = (uint32_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Entries that name a class are stores into `owner`, the function whose chunk holds the cache. */
+static InlineCacheEntry *inline_cache_resolve_instance(VM *vm, ObjFunction *owner, InlineCache *cache, ObjInstance *instance,
+                                                       ObjString *name) {
+    int slot = shape_find_slot(instance->shape, name);
+    if (slot >= 0) {
+        return inline_cache_store(cache, IC_FIELD, instance->shape, NULL, (uint32_t)slot, NULL);
+    }
+    uint32_t method_index = 0;
+    if (find_method_index(instance->klass, name, &method_index)) {
+        vm_write_barrier(vm, &owner->obj, value_make_class(instance->klass));
+        return inline_cache_store(cache, IC_METHOD, instance->shape, instance->klass, method_index, NULL);
+    }
+    return NULL;
+}
+
+static InlineCacheEntry *inline_cache_resolve_class(VM *vm, ObjFunction *owner, InlineCache *cache, ObjClass *klass,
+                                                    ObjString *name) {
+    uint32_t method_index = 0;
+    if (find_method_index(klass, name, &method_index)) {
+        vm_write_barrier(vm, &owner->obj, value_make_class(klass));
+        return inline_cache_store(cache, IC_CLASS_METHOD, NULL, klass, method_index, NULL);
+    }
+    return NULL;
+}
+
 static bool concatenate(VM *vm, Value *dest, Value left, Value right) {
     if (!value_is_string(left) || !value_is_string(right)) {
         return false;
     }
-    ObjString *a = value_as_string(left);
-    ObjString *b = value_as_string(right);
-    size_t length = a->length + b->length;
-    char *chars = (char *)malloc(length + 1);
-    if (!chars) {
-        fprintf(stderr, "Failed to concatenate strings.\n");
-        exit(EXIT_FAILURE);
-    }
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    ObjString *result = obj_string_take(vm, chars, length);
+    ObjString *result = obj_string_concat(vm, value_as_string(left), value_as_string(right));
     *dest = value_make_string(result);
     return true;
 }
 
-static uint8_t read_byte(CallFrame *frame) {
-    return *frame->ip++;
+/*
+ * The non-numeric cases of `+`: array append/extend and string
+ * concatenation. Returns the runtime error message, or NULL on success. The
+ * register file may move, so callers reload it before storing `*result`.
+ */
+static const char *add_values(VM *vm, Value a, Value b, Value *result) {
+    if (value_is_array(a)) {
+        ObjArray *left_array = value_as_array(a);
+        ObjArray *array = obj_array_copy(vm, left_array->elements.values, left_array->elements.count);
+        if (!array) {
+            return "Failed to allocate array.";
+        }
+        *result = value_make_array(array);
+        vm_push(vm, *result);
+        if (value_is_array(b)) {
+            ObjArray *right_array = value_as_array(b);
+            if (!obj_array_extend(vm, array, right_array->elements.values, right_array->elements.count)) {
+                vm_pop(vm);
+                return "Failed to extend array.";
+            }
+        } else if (!obj_array_append(vm, array, b)) {
+            vm_pop(vm);
+            return "Failed to append to array.";
+        }
+        vm_pop(vm);
+        return NULL;
+    }
+    if (value_is_array(b)) {
+        return "Left operand must be an array for array addition.";
+    }
+    if (value_is_string(a) && value_is_string(b)) {
+        if (!concatenate(vm, result, a, b)) {
+            return "Failed to concatenate strings.";
+        }
+        return NULL;
+    }
+    return "Operands must be numbers or strings.";
 }
 
-static uint16_t read_short(CallFrame *frame) {
-    frame->ip += 2;
-    uint16_t high = (uint16_t)frame->ip[-2];
-    uint16_t low = (uint16_t)frame->ip[-1];
-    return (uint16_t)((high << 8) | low);
+/* `+=`: an array on the left is extended in place; anything else adds as `+` does. */
+static const char *append_values(VM *vm, Value a, Value b, Value *result) {
+    if (!value_is_array(a)) {
+        return add_values(vm, a, b, result);
+    }
+    ObjArray *array = value_as_array(a);
+    if (value_is_array(b)) {
+        ObjArray *other = value_as_array(b);
+        if (!obj_array_extend(vm, array, other->elements.values, other->elements.count)) {
+            return "Failed to extend array.";
+        }
+    } else if (!obj_array_append(vm, array, b)) {
+        return "Failed to append to array.";
+    }
+    *result = a;
+    return NULL;
 }
 
+#if defined(__GNUC__) && !defined(VIBELANG_NO_COMPUTED_GOTO)
+#define VIBELANG_COMPUTED_GOTO
+#endif
+
 static InterpretResult run(VM *vm, Value *result_out) {
     uint8_t argument_registers[UINT8_MAX];
+    CallFrame *frame;
+    const uint8_t *ip;
+    Value *registers;
+    const Value *constants;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)(((uint16_t)ip[-2] << 8) | (uint16_t)ip[-1]))
+#define STORE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        ip = frame->ip; \
+        registers = frame->registers; \
+        constants = frame->function->chunk.constants.values; \
+    } while (0)
+#define RUNTIME_ERROR(message) \
+    do { \
+        STORE_FRAME(); \
+        runtime_error(vm, message); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (0)
+#define NUMBER_OPERANDS(message) \
+    do { \
+        if (!value_is_number(a) || !value_is_number(b)) { \
+            RUNTIME_ERROR(message); \
+        } \
+    } while (0)
+/*
+ * Quickening: a generic binary instruction that sees two numbers rewrites its
+ * own opcode (BINARY_LENGTH bytes back) to the specialised form. When an
+ * operand is not a number, the specialised form rewinds to its opcode,
+ * restores the generic one and dispatches it.
+ */
+#define BINARY_LENGTH 4
+#define QUICKEN(op) (((uint8_t *)ip)[-BINARY_LENGTH] = (op))
+#define DEQUICKEN(op) (ip -= BINARY_LENGTH, *(uint8_t *)ip = (op))
+
+#ifdef VIBELANG_COMPUTED_GOTO
+    /* Every opcode needs an entry here; missing ones would jump to NULL. */
+    static void *dispatch_table[] = {
+        [OP_LOAD_CONST] = &&target_OP_LOAD_CONST,
+        [OP_LOAD_NULL] = &&target_OP_LOAD_NULL,
+        [OP_LOAD_TRUE] = &&target_OP_LOAD_TRUE,
+        [OP_LOAD_FALSE] = &&target_OP_LOAD_FALSE,
+        [OP_MOVE] = &&target_OP_MOVE,
+        [OP_ADD] = &&target_OP_ADD,
+        [OP_SUBTRACT] = &&target_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&target_OP_MULTIPLY,
+        [OP_DIVIDE] = &&target_OP_DIVIDE,
+        [OP_NEGATE] = &&target_OP_NEGATE,
+        [OP_NOT] = &&target_OP_NOT,
+        [OP_EQUAL] = &&target_OP_EQUAL,
+        [OP_GREATER] = &&target_OP_GREATER,
+        [OP_LESS] = &&target_OP_LESS,
+        [OP_ADD_K] = &&target_OP_ADD_K,
+        [OP_APPEND_K] = &&target_OP_APPEND_K,
+        [OP_SUBTRACT_K] = &&target_OP_SUBTRACT_K,
+        [OP_MULTIPLY_K] = &&target_OP_MULTIPLY_K,
+        [OP_DIVIDE_K] = &&target_OP_DIVIDE_K,
+        [OP_EQUAL_K] = &&target_OP_EQUAL_K,
+        [OP_GREATER_K] = &&target_OP_GREATER_K,
+        [OP_LESS_K] = &&target_OP_LESS_K,
+        [OP_JUMP] = &&target_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&target_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&target_OP_JUMP_IF_TRUE,
+        [OP_JUMP_IF_LT] = &&target_OP_JUMP_IF_LT,
+        [OP_JUMP_IF_LE] = &&target_OP_JUMP_IF_LE,
+        [OP_JUMP_IF_GT] = &&target_OP_JUMP_IF_GT,
+        [OP_JUMP_IF_GE] = &&target_OP_JUMP_IF_GE,
+        [OP_JUMP_IF_EQ] = &&target_OP_JUMP_IF_EQ,
+        [OP_JUMP_IF_NE] = &&target_OP_JUMP_IF_NE,
+        [OP_JUMP_IF_LT_K] = &&target_OP_JUMP_IF_LT_K,
+        [OP_JUMP_IF_LE_K] = &&target_OP_JUMP_IF_LE_K,
+        [OP_JUMP_IF_GT_K] = &&target_OP_JUMP_IF_GT_K,
+        [OP_JUMP_IF_GE_K] = &&target_OP_JUMP_IF_GE_K,
+        [OP_JUMP_IF_EQ_K] = &&target_OP_JUMP_IF_EQ_K,
+        [OP_JUMP_IF_NE_K] = &&target_OP_JUMP_IF_NE_K,
+        [OP_LOOP] = &&target_OP_LOOP,
+        [OP_CALL] = &&target_OP_CALL,
+        [OP_BUILD_ARRAY] = &&target_OP_BUILD_ARRAY,
+        [OP_ARRAY_GET] = &&target_OP_ARRAY_GET,
+        [OP_APPEND] = &&target_OP_APPEND,
+        [OP_GET_PROPERTY] = &&target_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&target_OP_SET_PROPERTY,
+        [OP_CLASS] = &&target_OP_CLASS,
+        [OP_METHOD] = &&target_OP_METHOD,
+        [OP_INVOKE] = &&target_OP_INVOKE,
+        [OP_RETURN] = &&target_OP_RETURN,
+        [OP_GET_GLOBAL] = &&target_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&target_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&target_OP_SET_GLOBAL,
+        [OP_ADD_NUM] = &&target_OP_ADD_NUM,
+        [OP_APPEND_NUM] = &&target_OP_APPEND_NUM,
+        [OP_EQUAL_NUM] = &&target_OP_EQUAL_NUM
+    };
+#define TARGET(op) target_##op: case op
+#define DISPATCH() \
+    do { \
+        uint8_t next = READ_BYTE(); \
+        if (next >= sizeof(dispatch_table) / sizeof(dispatch_table[0])) { \
+            goto target_unknown; \
+        } \
+        goto *dispatch_table[next]; \
+    } while (0)
+#else
+#define TARGET(op) case op
+#define DISPATCH() continue
+#endif
+
+    LOAD_FRAME();
     for (;;) {
-        CallFrame *frame = &vm->frames[vm->frame_count - 1];
-        Value *registers = frame->registers;
-        uint8_t instruction = read_byte(frame);
-        switch (instruction) {
-            case OP_LOAD_CONST: {
-                uint8_t dest = read_byte(frame);
-                uint16_t index = read_short(frame);
-                registers[dest] = chunk_get_constant(&frame->function->chunk, index);
-                break;
-            }
-            case OP_LOAD_NULL: {
-                uint8_t dest = read_byte(frame);
+        switch (READ_BYTE()) {
+            TARGET(OP_LOAD_CONST): {
+                uint8_t dest = READ_BYTE();
+                uint16_t index = READ_SHORT();
+                registers[dest] = constants[index];
+                DISPATCH();
+            }
+            TARGET(OP_LOAD_NULL): {
+                uint8_t dest = READ_BYTE();
                 registers[dest] = value_make_null();
-                break;
+                DISPATCH();
             }
-            case OP_LOAD_TRUE: {
-                uint8_t dest = read_byte(frame);
+            TARGET(OP_LOAD_TRUE): {
+                uint8_t dest = READ_BYTE();
                 registers[dest] = value_make_bool(true);
-                break;
+                DISPATCH();
             }
-            case OP_LOAD_FALSE: {
-                uint8_t dest = read_byte(frame);
+            TARGET(OP_LOAD_FALSE): {
+                uint8_t dest = READ_BYTE();
                 registers[dest] = value_make_bool(false);
-                break;
+                DISPATCH();
             }
-            case OP_MOVE: {
-                uint8_t dest = read_byte(frame);
-                uint8_t src = read_byte(frame);
+            TARGET(OP_MOVE): {
+                uint8_t dest = READ_BYTE();
+                uint8_t src = READ_BYTE();
                 registers[dest] = registers[src];
-                break;
-            }
-            case OP_ADD:
-            case OP_SUBTRACT:
-            case OP_MULTIPLY:
-            case OP_DIVIDE:
-            case OP_EQUAL:
-            case OP_GREATER:
-            case OP_LESS: {
-                uint8_t dest = read_byte(frame);
-                uint8_t left = read_byte(frame);
-                uint8_t right = read_byte(frame);
-                Value a = registers[left];
-                Value b = registers[right];
-                switch (instruction) {
-                    case OP_ADD:
-                        if (value_is_array(a)) {
-                            ObjArray *left_array = value_as_array(a);
-                            ObjArray *result = obj_array_copy(vm, left_array->elements.values, left_array->elements.count);
-                            if (!result) {
-                                runtime_error(vm, "Failed to allocate array.");
-                                return INTERPRET_RUNTIME_ERROR;
-                            }
-                            Value array_value = value_make_array(result);
-                            vm_push(vm, array_value);
-                            if (value_is_array(b)) {
-                                ObjArray *right_array = value_as_array(b);
-                                if (!obj_array_extend(vm, result, right_array->elements.values, right_array->elements.count)) {
-                                    vm_pop(vm);
-                                    runtime_error(vm, "Failed to extend array.");
-                                    return INTERPRET_RUNTIME_ERROR;
-                                }
-                            } else {
-                                if (!obj_array_append(vm, result, b)) {
-                                    vm_pop(vm);
-                                    runtime_error(vm, "Failed to append to array.");
-                                    return INTERPRET_RUNTIME_ERROR;
-                                }
-                            }
-                            registers[dest] = array_value;
-                            vm_pop(vm);
-                            break;
-                        }
-                        if (value_is_array(b)) {
-                            runtime_error(vm, "Left operand must be an array for array addition.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        if (value_is_string(a) && value_is_string(b)) {
-                            if (!concatenate(vm, &registers[dest], a, b)) {
-                                runtime_error(vm, "Failed to concatenate strings.");
-                                return INTERPRET_RUNTIME_ERROR;
-                            }
-                            break;
-                        }
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers or strings.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
-                        break;
-                    case OP_SUBTRACT:
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_number(value_as_number(a) - value_as_number(b));
-                        break;
-                    case OP_MULTIPLY:
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_number(value_as_number(a) * value_as_number(b));
-                        break;
-                    case OP_DIVIDE:
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_number(value_as_number(a) / value_as_number(b));
-                        break;
-                    case OP_EQUAL:
-                        registers[dest] = value_make_bool(value_equals(a, b));
-                        break;
-                    case OP_GREATER:
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_bool(value_as_number(a) > value_as_number(b));
-                        break;
-                    case OP_LESS:
-                        if (!value_is_number(a) || !value_is_number(b)) {
-                            runtime_error(vm, "Operands must be numbers.");
-                            return INTERPRET_RUNTIME_ERROR;
-                        }
-                        registers[dest] = value_make_bool(value_as_number(a) < value_as_number(b));
-                        break;
-                    default:
-                        break;
+                DISPATCH();
+            }
+            TARGET(OP_ADD): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (value_is_number(a) && value_is_number(b)) {
+                    QUICKEN(OP_ADD_NUM);
+                    registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                    DISPATCH();
+                }
+                Value sum;
+                const char *error = add_values(vm, a, b, &sum);
+                if (error) {
+                    RUNTIME_ERROR(error);
+                }
+                registers = frame->registers;
+                registers[dest] = sum;
+                DISPATCH();
+            }
+            TARGET(OP_ADD_NUM): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (!value_is_number(a) || !value_is_number(b)) {
+                    DEQUICKEN(OP_ADD);
+                    DISPATCH();
+                }
+                registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_SUBTRACT): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) - value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_MULTIPLY): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) * value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_DIVIDE): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) / value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_EQUAL): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (value_is_number(a) && value_is_number(b)) {
+                    QUICKEN(OP_EQUAL_NUM);
+                }
+                registers[dest] = value_make_bool(value_equals(a, b));
+                DISPATCH();
+            }
+            TARGET(OP_APPEND_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                if (value_is_number(a) && value_is_number(b)) {
+                    registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                    DISPATCH();
+                }
+                Value sum;
+                const char *error = append_values(vm, a, b, &sum);
+                if (error) {
+                    RUNTIME_ERROR(error);
+                }
+                registers = frame->registers;
+                registers[dest] = sum;
+                DISPATCH();
+            }
+            TARGET(OP_APPEND_NUM): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (!value_is_number(a) || !value_is_number(b)) {
+                    DEQUICKEN(OP_APPEND);
+                    DISPATCH();
+                }
+                registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_EQUAL_NUM): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (!value_is_number(a) || !value_is_number(b)) {
+                    DEQUICKEN(OP_EQUAL);
+                    DISPATCH();
+                }
+                registers[dest] = value_make_bool(value_as_number(a) == value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_GREATER): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_bool(value_as_number(a) > value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_LESS): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_bool(value_as_number(a) < value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_ADD_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                if (value_is_number(a) && value_is_number(b)) {
+                    registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                    DISPATCH();
                 }
-                break;
+                Value sum;
+                const char *error = add_values(vm, a, b, &sum);
+                if (error) {
+                    RUNTIME_ERROR(error);
+                }
+                registers = frame->registers;
+                registers[dest] = sum;
+                DISPATCH();
+            }
+            TARGET(OP_SUBTRACT_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) - value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_MULTIPLY_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) * value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_DIVIDE_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_number(value_as_number(a) / value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_GREATER_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_bool(value_as_number(a) > value_as_number(b));
+                DISPATCH();
             }
-            case OP_NOT: {
-                uint8_t dest = read_byte(frame);
-                uint8_t operand = read_byte(frame);
+            TARGET(OP_LESS_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                NUMBER_OPERANDS("Operands must be numbers.");
+                registers[dest] = value_make_bool(value_as_number(a) < value_as_number(b));
+                DISPATCH();
+            }
+            TARGET(OP_EQUAL_K): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                registers[dest] = value_make_bool(value_equals(a, b));
+                DISPATCH();
+            }
+            TARGET(OP_NOT): {
+                uint8_t dest = READ_BYTE();
+                uint8_t operand = READ_BYTE();
                 registers[dest] = value_make_bool(!value_is_truthy(registers[operand]));
-                break;
+                DISPATCH();
             }
-            case OP_NEGATE: {
-                uint8_t dest = read_byte(frame);
-                uint8_t operand = read_byte(frame);
+            TARGET(OP_NEGATE): {
+                uint8_t dest = READ_BYTE();
+                uint8_t operand = READ_BYTE();
                 Value value = registers[operand];
                 if (!value_is_number(value)) {
-                    runtime_error(vm, "Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Operand must be a number.");
                 }
                 registers[dest] = value_make_number(-value_as_number(value));
-                break;
+                DISPATCH();
             }
-            case OP_JUMP: {
-                uint16_t offset = read_short(frame);
-                frame->ip += offset;
-                break;
+            TARGET(OP_JUMP): {
+                uint16_t offset = READ_SHORT();
+                ip += offset;
+                DISPATCH();
             }
-            case OP_JUMP_IF_FALSE: {
-                uint8_t condition = read_byte(frame);
-                uint16_t offset = read_short(frame);
+            TARGET(OP_JUMP_IF_FALSE): {
+                uint8_t condition = READ_BYTE();
+                uint16_t offset = READ_SHORT();
                 if (!value_is_truthy(registers[condition])) {
-                    frame->ip += offset;
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_TRUE): {
+                uint8_t condition = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                if (value_is_truthy(registers[condition])) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_LT): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (value_as_number(a) < value_as_number(b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_LE): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (!(value_as_number(a) > value_as_number(b))) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_GT): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (value_as_number(a) > value_as_number(b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_GE): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (!(value_as_number(a) < value_as_number(b))) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_EQ): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (value_equals(a, b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_NE): {
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (!value_equals(a, b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_LT_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (value_as_number(a) < value_as_number(b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_LE_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (!(value_as_number(a) > value_as_number(b))) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_GT_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (value_as_number(a) > value_as_number(b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_GE_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                NUMBER_OPERANDS("Operands must be numbers.");
+                if (!(value_as_number(a) < value_as_number(b))) {
+                    ip += offset;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_LOOP: {
-                uint16_t offset = read_short(frame);
-                frame->ip -= offset;
-                break;
+            TARGET(OP_JUMP_IF_EQ_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                if (value_equals(a, b)) {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+            TARGET(OP_JUMP_IF_NE_K): {
+                Value a = registers[READ_BYTE()];
+                Value b = constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                if (!value_equals(a, b)) {
+                    ip += offset;
+                }
+                DISPATCH();
             }
-            case OP_CALL: {
-                uint8_t dest = read_byte(frame);
-                uint8_t callee_reg = read_byte(frame);
-                uint8_t arg_count = read_byte(frame);
+            TARGET(OP_LOOP): {
+                uint16_t offset = READ_SHORT();
+                ip -= offset;
+                DISPATCH();
+            }
+            TARGET(OP_CALL): {
+                uint8_t dest = READ_BYTE();
+                uint8_t callee_reg = READ_BYTE();
+                uint8_t arg_count = READ_BYTE();
                 for (uint8_t i = 0; i < arg_count; ++i) {
-                    argument_registers[i] = read_byte(frame);
+                    argument_registers[i] = READ_BYTE();
                 }
                 Value callee = registers[callee_reg];
+                STORE_FRAME();
                 if (!call_value(vm, frame, dest, callee, arg_count, argument_registers)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                continue;
+                LOAD_FRAME();
+                DISPATCH();
             }
-            case OP_BUILD_ARRAY: {
-                uint8_t dest = read_byte(frame);
-                uint8_t element_count = read_byte(frame);
+            TARGET(OP_BUILD_ARRAY): {
+                uint8_t dest = READ_BYTE();
+                uint8_t element_count = READ_BYTE();
                 ObjArray *array = obj_array_new(vm);
                 if (!array) {
-                    runtime_error(vm, "Failed to allocate array.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Failed to allocate array.");
                 }
                 Value array_value = value_make_array(array);
                 vm_push(vm, array_value);
+                registers = frame->registers;
                 for (uint8_t i = 0; i < element_count; ++i) {
-                    uint8_t source_reg = read_byte(frame);
+                    uint8_t source_reg = READ_BYTE();
                     if (!obj_array_append(vm, array, registers[source_reg])) {
                         vm_pop(vm);
-                        runtime_error(vm, "Failed to append to array.");
-                        return INTERPRET_RUNTIME_ERROR;
+                        RUNTIME_ERROR("Failed to append to array.");
                     }
                 }
                 registers[dest] = array_value;
                 vm_pop(vm);
-                break;
+                DISPATCH();
             }
-            case OP_ARRAY_GET: {
-                uint8_t dest = read_byte(frame);
-                uint8_t array_reg = read_byte(frame);
-                uint8_t index_reg = read_byte(frame);
+            TARGET(OP_ARRAY_GET): {
+                uint8_t dest = READ_BYTE();
+                uint8_t array_reg = READ_BYTE();
+                uint8_t index_reg = READ_BYTE();
                 Value array_value = registers[array_reg];
                 Value index_value = registers[index_reg];
                 if (!value_is_array(array_value)) {
-                    runtime_error(vm, "Operand is not an array.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Operand is not an array.");
                 }
                 if (!value_is_number(index_value)) {
-                    runtime_error(vm, "Array index must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Array index must be a number.");
                 }
                 double index_double = value_as_number(index_value);
                 if (index_double < 0.0 || index_double > (double)SIZE_MAX) {
-                    runtime_error(vm, "Array index out of bounds.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Array index out of bounds.");
                 }
                 size_t index = (size_t)index_double;
                 if ((double)index != index_double) {
-                    runtime_error(vm, "Array index must be an integer.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Array index must be an integer.");
                 }
                 ObjArray *array_obj = value_as_array(array_value);
                 if (index >= array_obj->elements.count) {
-                    runtime_error(vm, "Array index out of range.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Array index out of range.");
                 }
                 registers[dest] = array_obj->elements.values[index];
-                break;
+                DISPATCH();
             }
-            case OP_GET_PROPERTY: {
-                uint8_t dest = read_byte(frame);
-                uint8_t object_reg = read_byte(frame);
-                uint16_t name_index = read_short(frame);
-                Value object = registers[object_reg];
-                Value name_value = chunk_get_constant(&frame->function->chunk, name_index);
-                if (!value_is_string(name_value)) {
-                    runtime_error(vm, "Property name must be a string constant.");
-                    return INTERPRET_RUNTIME_ERROR;
+            TARGET(OP_APPEND): {
+                uint8_t dest = READ_BYTE();
+                Value a = registers[READ_BYTE()];
+                Value b = registers[READ_BYTE()];
+                if (value_is_number(a) && value_is_number(b)) {
+                    QUICKEN(OP_APPEND_NUM);
+                    registers[dest] = value_make_number(value_as_number(a) + value_as_number(b));
+                    DISPATCH();
                 }
-                ObjString *name = value_as_string(name_value);
+                Value sum;
+                const char *error = append_values(vm, a, b, &sum);
+                if (error) {
+                    RUNTIME_ERROR(error);
+                }
+                registers = frame->registers;
+                registers[dest] = sum;
+                DISPATCH();
+            }
+            TARGET(OP_GET_PROPERTY): {
+                uint8_t dest = READ_BYTE();
+                uint8_t object_reg = READ_BYTE();
+                uint16_t name_index = READ_SHORT();
+                uint16_t cache_index = READ_SHORT();
+                Value object = registers[object_reg];
+                InlineCache *cache = &frame->function->chunk.caches[cache_index];
 
                 if (value_is_instance(object)) {
                     ObjInstance *instance = value_as_instance(object);
-                    Value field;
-                    if (obj_instance_get_field(instance, name, &field)) {
-                        registers[dest] = field;
-                        break;
-                    }
-                    Value method_value;
-                    if (obj_class_find_method(instance->klass, name, &method_value)) {
-                        if (!value_is_function(method_value)) {
-                            runtime_error(vm, "Method value is not callable.");
-                            return INTERPRET_RUNTIME_ERROR;
+                    InlineCacheEntry *entry = inline_cache_find(cache, instance->shape, instance->klass);
+                    if (entry) {
+                        vm->ic_hits++;
+                    } else {
+                        vm->ic_misses++;
+                        Value name_value = constants[name_index];
+                        if (!value_is_string(name_value)) {
+                            RUNTIME_ERROR("Property name must be a string constant.");
+                        }
+                        entry = inline_cache_resolve_instance(vm, frame->function, cache, instance, value_as_string(name_value));
+                        if (!entry) {
+                            RUNTIME_ERROR("Undefined property on instance.");
                         }
-                        ObjBoundMethod *bound = obj_bound_method_new(vm, object, value_as_function(method_value));
-                        registers[dest] = value_make_bound_method(bound);
-                        break;
                     }
-                    runtime_error(vm, "Undefined property on instance.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    if (entry->kind == IC_FIELD) {
+                        registers[dest] = instance->slots[entry->index];
+                        DISPATCH();
+                    }
+                    Value method_value = instance->klass->methods[entry->index].value;
+                    if (!value_is_function(method_value)) {
+                        RUNTIME_ERROR("Method value is not callable.");
+                    }
+                    ObjBoundMethod *bound = obj_bound_method_new(vm, object, value_as_function(method_value));
+                    registers[dest] = value_make_bound_method(bound);
+                    DISPATCH();
                 }
 
                 if (value_is_class(object)) {
                     ObjClass *klass = value_as_class(object);
-                    Value method_value;
-                    if (obj_class_find_method(klass, name, &method_value)) {
-                        registers[dest] = method_value;
-                        break;
+                    InlineCacheEntry *entry = inline_cache_find(cache, NULL, klass);
+                    if (entry) {
+                        vm->ic_hits++;
+                    } else {
+                        vm->ic_misses++;
+                        Value name_value = constants[name_index];
+                        if (!value_is_string(name_value)) {
+                            RUNTIME_ERROR("Property name must be a string constant.");
+                        }
+                        entry = inline_cache_resolve_class(vm, frame->function, cache, klass, value_as_string(name_value));
+                        if (!entry) {
+                            RUNTIME_ERROR("Undefined property on class.");
+                        }
                     }
-                    runtime_error(vm, "Undefined property on class.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    registers[dest] = klass->methods[entry->index].value;
+                    DISPATCH();
                 }
 
-                runtime_error(vm, "Only instances and classes have properties.");
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Only instances and classes have properties.");
             }
-            case OP_SET_PROPERTY: {
-                uint8_t object_reg = read_byte(frame);
-                uint16_t name_index = read_short(frame);
-                uint8_t value_reg = read_byte(frame);
+            TARGET(OP_SET_PROPERTY): {
+                uint8_t object_reg = READ_BYTE();
+                uint16_t name_index = READ_SHORT();
+                uint8_t value_reg = READ_BYTE();
+                uint16_t cache_index = READ_SHORT();
                 Value object = registers[object_reg];
-                Value name_value = chunk_get_constant(&frame->function->chunk, name_index);
-                if (!value_is_string(name_value)) {
-                    runtime_error(vm, "Property name must be a string constant.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                ObjString *name = value_as_string(name_value);
                 if (!value_is_instance(object)) {
-                    runtime_error(vm, "Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Only instances have fields.");
                 }
                 ObjInstance *instance = value_as_instance(object);
-                if (!obj_instance_set_field(vm, instance, name, registers[value_reg])) {
-                    runtime_error(vm, "Failed to set instance field.");
-                    return INTERPRET_RUNTIME_ERROR;
+                InlineCache *cache = &frame->function->chunk.caches[cache_index];
+                InlineCacheEntry *entry = inline_cache_find(cache, instance->shape, instance->klass);
+                if (entry) {
+                    vm->ic_hits++;
+                } else {
+                    vm->ic_misses++;
+                    Value name_value = constants[name_index];
+                    if (!value_is_string(name_value)) {
+                        RUNTIME_ERROR("Property name must be a string constant.");
+                    }
+                    ObjString *name = value_as_string(name_value);
+                    int slot = shape_find_slot(instance->shape, name);
+                    if (slot >= 0) {
+                        entry = inline_cache_store(cache, IC_FIELD, instance->shape, NULL, (uint32_t)slot, NULL);
+                    } else {
+                        Shape *next = vm_shape_transition(vm, instance->shape, name);
+                        entry = inline_cache_store(cache, IC_TRANSITION, instance->shape, NULL, (uint32_t)(next->slot_count - 1), next);
+                    }
+                }
+                if (entry->kind == IC_FIELD) {
+                    instance->slots[entry->index] = registers[value_reg];
+                    vm_write_barrier(vm, &instance->obj, registers[value_reg]);
+                    DISPATCH();
                 }
-                break;
+                if (!obj_instance_transition(vm, instance, entry->transition, registers[value_reg])) {
+                    RUNTIME_ERROR("Failed to set instance field.");
+                }
+                DISPATCH();
             }
-            case OP_CLASS: {
-                uint8_t dest = read_byte(frame);
-                uint16_t name_index = read_short(frame);
-                Value name_value = chunk_get_constant(&frame->function->chunk, name_index);
+            TARGET(OP_CLASS): {
+                uint8_t dest = READ_BYTE();
+                uint16_t name_index = READ_SHORT();
+                Value name_value = constants[name_index];
                 if (!value_is_string(name_value)) {
-                    runtime_error(vm, "Class name must be a string.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Class name must be a string.");
                 }
                 ObjString *name = value_as_string(name_value);
                 ObjClass *klass = obj_class_new(vm, name);
                 registers[dest] = value_make_class(klass);
-                break;
+                DISPATCH();
             }
-            case OP_METHOD: {
-                uint8_t class_reg = read_byte(frame);
-                uint16_t name_index = read_short(frame);
-                uint8_t method_reg = read_byte(frame);
+            TARGET(OP_METHOD): {
+                uint8_t class_reg = READ_BYTE();
+                uint16_t name_index = READ_SHORT();
+                uint8_t method_reg = READ_BYTE();
                 Value class_value = registers[class_reg];
-                Value name_value = chunk_get_constant(&frame->function->chunk, name_index);
+                Value name_value = constants[name_index];
                 if (!value_is_class(class_value)) {
-                    runtime_error(vm, "OP_METHOD target is not a class.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("OP_METHOD target is not a class.");
                 }
                 if (!value_is_string(name_value)) {
-                    runtime_error(vm, "Method name must be a string.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Method name must be a string.");
                 }
                 ObjClass *klass = value_as_class(class_value);
                 ObjString *name = value_as_string(name_value);
                 Value method = registers[method_reg];
                 if (!obj_class_define_method(vm, klass, name, method)) {
-                    runtime_error(vm, "Failed to define method.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Failed to define method.");
                 }
-                break;
+                DISPATCH();
             }
-            case OP_INVOKE: {
-                uint8_t dest = read_byte(frame);
-                uint8_t object_reg = read_byte(frame);
-                uint16_t name_index = read_short(frame);
-                uint8_t arg_count = read_byte(frame);
+            TARGET(OP_INVOKE): {
+                uint8_t dest = READ_BYTE();
+                uint8_t object_reg = READ_BYTE();
+                uint16_t name_index = READ_SHORT();
+                uint16_t cache_index = READ_SHORT();
+                uint8_t arg_count = READ_BYTE();
                 for (uint8_t i = 0; i < arg_count; ++i) {
-                    argument_registers[i] = read_byte(frame);
+                    argument_registers[i] = READ_BYTE();
                 }
                 Value receiver = registers[object_reg];
-                Value name_value = chunk_get_constant(&frame->function->chunk, name_index);
-                if (!value_is_string(name_value)) {
-                    runtime_error(vm, "Method name must be a string.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                ObjString *name = value_as_string(name_value);
+                InlineCache *cache = &frame->function->chunk.caches[cache_index];
 
                 Value callee;
-                bool pushed_bound = false;
                 if (value_is_instance(receiver)) {
                     ObjInstance *instance = value_as_instance(receiver);
-                    Value field;
-                    if (obj_instance_get_field(instance, name, &field)) {
-                        callee = field;
+                    InlineCacheEntry *entry = inline_cache_find(cache, instance->shape, instance->klass);
+                    if (entry) {
+                        vm->ic_hits++;
                     } else {
-                        Value method_value;
-                        if (!obj_class_find_method(instance->klass, name, &method_value)) {
-                            runtime_error(vm, "Undefined method on instance.");
-                            return INTERPRET_RUNTIME_ERROR;
+                        vm->ic_misses++;
+                        Value name_value = constants[name_index];
+                        if (!value_is_string(name_value)) {
+                            RUNTIME_ERROR("Method name must be a string.");
                         }
+                        entry = inline_cache_resolve_instance(vm, frame->function, cache, instance, value_as_string(name_value));
+                        if (!entry) {
+                            RUNTIME_ERROR("Undefined method on instance.");
+                        }
+                    }
+                    if (entry->kind == IC_FIELD) {
+                        callee = instance->slots[entry->index];
+                    } else {
+                        Value method_value = instance->klass->methods[entry->index].value;
                         if (!value_is_function(method_value)) {
-                            runtime_error(vm, "Method value is not callable.");
+                            RUNTIME_ERROR("Method value is not callable.");
+                        }
+                        STORE_FRAME();
+                        if (!call_function(vm, frame, value_as_function(method_value), dest, &receiver, arg_count, argument_registers)) {
                             return INTERPRET_RUNTIME_ERROR;
                         }
-                        ObjBoundMethod *bound = obj_bound_method_new(vm, receiver, value_as_function(method_value));
-                        Value bound_value = value_make_bound_method(bound);
-                        vm_push(vm, bound_value);
-                        registers[dest] = bound_value;
-                        callee = bound_value;
-                        pushed_bound = true;
+                        LOAD_FRAME();
+                        DISPATCH();
                     }
                 } else if (value_is_class(receiver)) {
                     ObjClass *klass = value_as_class(receiver);
-                    Value method_value;
-                    if (!obj_class_find_method(klass, name, &method_value)) {
-                        runtime_error(vm, "Undefined method on class.");
-                        return INTERPRET_RUNTIME_ERROR;
+                    InlineCacheEntry *entry = inline_cache_find(cache, NULL, klass);
+                    if (entry) {
+                        vm->ic_hits++;
+                    } else {
+                        vm->ic_misses++;
+                        Value name_value = constants[name_index];
+                        if (!value_is_string(name_value)) {
+                            RUNTIME_ERROR("Method name must be a string.");
+                        }
+                        entry = inline_cache_resolve_class(vm, frame->function, cache, klass, value_as_string(name_value));
+                        if (!entry) {
+                            RUNTIME_ERROR("Undefined method on class.");
+                        }
                     }
-                    callee = method_value;
+                    callee = klass->methods[entry->index].value;
                 } else {
-                    runtime_error(vm, "Only instances and classes have methods.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Only instances and classes have methods.");
                 }
 
+                STORE_FRAME();
                 if (!call_value(vm, frame, dest, callee, arg_count, argument_registers)) {
-                    if (pushed_bound) {
-                        vm_pop(vm);
-                    }
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                if (pushed_bound) {
-                    vm_pop(vm);
-                }
-                continue;
+                LOAD_FRAME();
+                DISPATCH();
             }
-            case OP_RETURN: {
-                uint8_t src = read_byte(frame);
+            TARGET(OP_RETURN): {
+                uint8_t src = READ_BYTE();
                 Value result = registers[src];
                 Value *callee_registers = frame->registers;
                 Value *caller_registers = frame->caller_registers;
@@ -935,51 +1728,62 @@ static InterpretResult run(VM *vm, Value *result_out) {
                     return INTERPRET_OK;
                 }
 
-                CallFrame *caller = &vm->frames[vm->frame_count - 1];
                 if (caller_registers) {
                     caller_registers[return_reg] = result;
                 }
-                vm->stack_top = caller->registers + caller->function->register_count;
-                continue;
+                LOAD_FRAME();
+                vm->stack_top = registers + frame->function->register_count;
+                DISPATCH();
             }
-            case OP_GET_GLOBAL: {
-                uint8_t dest = read_byte(frame);
-                uint16_t slot = read_short(frame);
+            TARGET(OP_GET_GLOBAL): {
+                uint8_t dest = READ_BYTE();
+                uint16_t slot = READ_SHORT();
                 if (slot >= vm->global_count || !vm->global_defined[slot]) {
-                    runtime_error(vm, "Undefined global variable.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Undefined global variable.");
                 }
                 registers[dest] = vm->globals[slot];
-                break;
+                DISPATCH();
             }
-            case OP_DEFINE_GLOBAL: {
-                uint8_t src = read_byte(frame);
-                uint16_t slot = read_short(frame);
+            TARGET(OP_DEFINE_GLOBAL): {
+                uint8_t src = READ_BYTE();
+                uint16_t slot = READ_SHORT();
                 size_t required = (size_t)slot + 1;
                 if (!ensure_globals_capacity(vm, required)) {
-                    runtime_error(vm, "Unable to expand globals array.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Unable to expand globals array.");
                 }
                 if (required > vm->global_count) {
                     vm->global_count = required;
                 }
-                vm->globals[slot] = registers[src];
+                write_global(vm, slot, registers[src]);
                 vm->global_defined[slot] = true;
-                break;
+                DISPATCH();
             }
-            case OP_SET_GLOBAL: {
-                uint8_t src = read_byte(frame);
-                uint16_t slot = read_short(frame);
+            TARGET(OP_SET_GLOBAL): {
+                uint8_t src = READ_BYTE();
+                uint16_t slot = READ_SHORT();
                 if (slot >= vm->global_count || !vm->global_defined[slot]) {
-                    runtime_error(vm, "Undefined global variable.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Undefined global variable.");
                 }
-                vm->globals[slot] = registers[src];
-                break;
+                write_global(vm, slot, registers[src]);
+                DISPATCH();
             }
             default:
-                runtime_error(vm, "Unknown opcode.");
-                return INTERPRET_RUNTIME_ERROR;
+#ifdef VIBELANG_COMPUTED_GOTO
+            target_unknown:
+#endif
+                RUNTIME_ERROR("Unknown opcode.");
         }
     }
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef NUMBER_OPERANDS
+#undef BINARY_LENGTH
+#undef QUICKEN
+#undef DEQUICKEN
+#undef TARGET
+#undef DISPATCH
 }
@@ -3,15 +3,36 @@
 
 #include <stdint.h>
 
+#include "heap.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
+#define GC_DEFAULT_HEAP_GROW_FACTOR 2.0
+#define GC_DEFAULT_MIN_HEAP_SIZE (1024 * 1024)
+#define GC_DEFAULT_NURSERY_SIZE (256 * 1024)
+#define GC_DEFAULT_SLICE_BUDGET 4096
+#define GC_DEFAULT_SLICE_BYTES (32 * 1024)
+/* Objects swept by each allocation while a cycle is sweeping. */
+#define GC_LAZY_SWEEP_BATCH 8
+
+typedef enum {
+    GC_PHASE_IDLE,
+    GC_PHASE_MARKING,
+    GC_PHASE_SWEEPING
+} GcPhase;
+
 typedef enum {
     INTERPRET_OK,
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+/* Names the runtime looks up itself, interned once by vm_init. */
+typedef enum {
+    VM_NAME_CONSTRUCTOR,
+    VM_NAME_COUNT
+} VMName;
+
 typedef struct {
     ObjFunction *function;
     const uint8_t *ip;
@@ -31,19 +52,84 @@ typedef struct VM {
     bool *global_defined;
     size_t global_count;
     size_t global_capacity;
+    /* Globals given a young object since the last collection all lie in [dirty_from, dirty_to). */
+    size_t globals_dirty_from;
+    size_t globals_dirty_to;
     Table strings;
-    Obj *objects;
+    ObjString *names[VM_NAME_COUNT];
+    Shape *root_shape;
+    /* Every object lives in the heap; those allocated since the last collection are also on young_objects. */
+    Heap heap;
+    Obj *young_objects;
     size_t bytes_allocated;
     size_t next_gc;
+    double gc_heap_grow_factor;
+    size_t gc_min_heap_size;
+    /* A minor collection runs once this many bytes were allocated since the last one (0 disables them). */
+    size_t gc_nursery_size;
+    size_t bytes_at_last_gc;
     Obj **gray_stack;
     int gray_count;
     int gray_capacity;
+    Obj **remembered;
+    int remembered_count;
+    int remembered_capacity;
+    /*
+     * Full collections run incrementally: marking advances by
+     * gc_slice_budget units of work every gc_slice_bytes of allocation while
+     * the mutator runs in between (a budget of 0 marks in one go).
+     */
+    GcPhase gc_phase;
+    uint8_t gc_epoch;
+    size_t gc_slice_budget;
+    size_t gc_slice_bytes;
+    size_t gc_next_slice;
+    /* Sweeping happens lazily in allocate_object, through the heap's sweep cursor. */
+    Obj *sweep_young;
+    size_t gc_minor_collections;
+    size_t gc_major_collections;
+    size_t gc_slices;
+    /* Time spent in collector pauses, and in sweeping moved out of them. */
+    uint64_t gc_pause_ns;
+    uint64_t gc_max_pause_ns;
+    uint64_t gc_max_minor_pause_ns;
+    uint64_t gc_lazy_sweep_ns;
+    size_t ic_hits;
+    size_t ic_misses;
+    /* Report per-function instruction counts from the peephole pass on stderr. */
+    bool print_peephole_stats;
 } VM;
 
 void vm_init(VM *vm);
 void vm_free(VM *vm);
 InterpretResult vm_interpret(VM *vm, ObjFunction *function, Value *result_out);
+/* Full collection of both generations; finishes an in-progress cycle first. */
 void vm_collect_garbage(VM *vm);
+/* Runs one slice of the current full cycle, starting one if none is active. */
+void vm_collect_step(VM *vm);
+/* Minor collection: frees unreachable young objects and promotes the rest. */
+void vm_collect_nursery(VM *vm);
+void vm_configure_gc(VM *vm, double heap_grow_factor, size_t min_heap_size);
+void vm_configure_nursery(VM *vm, size_t nursery_size);
+void vm_configure_incremental(VM *vm, size_t slice_budget, size_t slice_bytes);
+void vm_remember(VM *vm, Obj *owner);
+void vm_write_barrier_slow(VM *vm, Obj *owner, Obj *target);
+/* shape_transition for instances of this VM; the field name is kept alive by the shape tree from then on. */
+Shape *vm_shape_transition(VM *vm, Shape *shape, ObjString *name);
+/* Sweeps a batch if a cycle is sweeping, then takes memory for a `size`-byte object from the heap. */
+Obj *vm_allocate_cell(VM *vm, size_t size);
+
+/*
+ * Write barrier: call after storing `value` into a field of `owner` that
+ * already existed. While a cycle is marking, a black owner shades the stored
+ * object so it cannot be missed; otherwise an old owner that gains a reference
+ * to a young object is traced by the next minor collection.
+ */
+static inline void vm_write_barrier(VM *vm, Obj *owner, Value value) {
+    if (value_is_obj(value) && value_as_obj(value)->mark != vm->gc_epoch && !obj_is_young(owner)) {
+        vm_write_barrier_slow(vm, owner, value_as_obj(value));
+    }
+}
 void vm_push(VM *vm, Value value);
 Value vm_pop(VM *vm);
 
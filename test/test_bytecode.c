@@ -0,0 +1,150 @@
+#include "../libs/Unity/src/unity.h"
+
+#include "bytecode.h"
+#include "compiler.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *CACHED_SCRIPT =
+    "class Counter {\n"
+    "  constructor(start) {\n"
+    "    this.count = start;\n"
+    "  }\n"
+    "  add(n) {\n"
+    "    this.count = this.count + n;\n"
+    "    return this;\n"
+    "  }\n"
+    "}\n"
+    "function twice(x) {\n"
+    "  function inner(y) {\n"
+    "    return y * 2;\n"
+    "  }\n"
+    "  return inner(x);\n"
+    "}\n"
+    "let items = [\"a\", \"b\"];\n"
+    "items += [\"c\"];\n"
+    "Counter(1.5).add(twice(20)).count;\n";
+
+static ObjFunction *compile_or_fail(VM *vm, const char *source) {
+    char *error = NULL;
+    ObjFunction *function = compiler_compile_source(vm, source, &error);
+    if (!function) {
+        TEST_FAIL_MESSAGE(error ? error : "compiler_compile_source failed");
+    }
+    return function;
+}
+
+static void serialize_or_fail(const char *source, uint64_t hash, int64_t mtime, uint8_t **data, size_t *size) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = compile_or_fail(&vm, source);
+    TEST_ASSERT_TRUE(bytecode_serialize(function, hash, mtime, data, size));
+    vm_free(&vm);
+}
+
+void test_bytecode_round_trip_runs(void) {
+    uint64_t hash = bytecode_hash_source(CACHED_SCRIPT, strlen(CACHED_SCRIPT));
+    uint8_t *data = NULL;
+    size_t size = 0;
+    serialize_or_fail(CACHED_SCRIPT, hash, 1234, &data, &size);
+
+    VM vm;
+    vm_init(&vm);
+    vm_configure_gc(&vm, 2.0, 0);
+    ObjFunction *function = bytecode_deserialize(&vm, data, size, hash, 1234);
+    TEST_ASSERT_NOT_NULL(function);
+    TEST_ASSERT_EQUAL_STRING("script", function->name->chars);
+    int last_line = 0;
+    for (int offset = 0; offset < function->chunk.count; offset++) {
+        int line = chunk_get_line(&function->chunk, offset);
+        last_line = line > last_line ? line : last_line;
+    }
+    TEST_ASSERT_EQUAL_INT(18, last_line);
+
+    Value result = value_make_null();
+    char *error = NULL;
+    TEST_ASSERT_TRUE(compiler_run_function(&vm, function, &result, &error));
+    TEST_ASSERT_TRUE(value_is_number(result));
+    TEST_ASSERT_TRUE(fabs(value_as_number(result) - 41.5) < 1e-9);
+
+    vm_free(&vm);
+    free(data);
+}
+
+void test_bytecode_rejects_stale_or_corrupt_images(void) {
+    uint64_t hash = bytecode_hash_source(CACHED_SCRIPT, strlen(CACHED_SCRIPT));
+    uint8_t *data = NULL;
+    size_t size = 0;
+    serialize_or_fail(CACHED_SCRIPT, hash, 99, &data, &size);
+
+    VM vm;
+    vm_init(&vm);
+    TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, size, hash + 1, 99));
+    TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, size, hash, 100));
+    for (size_t cut = 0; cut < size; cut += 7) {
+        TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, cut, hash, 99));
+    }
+    /* A body that no longer fits its header: the script needs more than one register. */
+    uint8_t register_count = data[28];
+    data[28] = 1;
+    TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, size, hash, 99));
+    data[28] = register_count;
+    TEST_ASSERT_NOT_NULL(bytecode_deserialize(&vm, data, size, hash, 99));
+    data[4] ^= 0xFF;
+    TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, size, hash, 99));
+
+    vm_free(&vm);
+    free(data);
+}
+
+void test_bytecode_rejects_nan_tagged_constants(void) {
+    uint64_t hash = bytecode_hash_source(CACHED_SCRIPT, strlen(CACHED_SCRIPT));
+    uint8_t *data = NULL;
+    size_t size = 0;
+    serialize_or_fail(CACHED_SCRIPT, hash, 7, &data, &size);
+
+    /* The constant 1.5, stored little-endian. */
+    const uint8_t number[8] = {0, 0, 0, 0, 0, 0, 0xF8, 0x3F};
+    size_t offset = 0;
+    while (offset + sizeof(number) <= size && memcmp(data + offset, number, sizeof(number)) != 0) {
+        offset++;
+    }
+    TEST_ASSERT_TRUE(offset + sizeof(number) <= size);
+
+    /* Under NaN boxing these bits would decode as a pointer to address 0x1000. */
+    const uint8_t forged[8] = {0x00, 0x10, 0, 0, 0, 0, 0xFC, 0xFF};
+    memcpy(data + offset, forged, sizeof(forged));
+    VM vm;
+    vm_init(&vm);
+    TEST_ASSERT_NULL(bytecode_deserialize(&vm, data, size, hash, 7));
+    memcpy(data + offset, number, sizeof(number));
+    TEST_ASSERT_NOT_NULL(bytecode_deserialize(&vm, data, size, hash, 7));
+
+    vm_free(&vm);
+    free(data);
+}
+
+void test_bytecode_file_cache_round_trip(void) {
+    char path[] = "build/test_bytecode_cache.vibec";
+    uint64_t hash = bytecode_hash_source(CACHED_SCRIPT, strlen(CACHED_SCRIPT));
+
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = compile_or_fail(&vm, CACHED_SCRIPT);
+    TEST_ASSERT_TRUE(bytecode_write_file(path, function, hash, 7));
+    vm_free(&vm);
+
+    vm_init(&vm);
+    TEST_ASSERT_NULL(bytecode_read_file(&vm, "build/missing.vibec", hash, 7));
+    function = bytecode_read_file(&vm, path, hash, 7);
+    TEST_ASSERT_NOT_NULL(function);
+    Value result = value_make_null();
+    TEST_ASSERT_TRUE(compiler_run_function(&vm, function, &result, NULL));
+    TEST_ASSERT_TRUE(fabs(value_as_number(result) - 41.5) < 1e-9);
+    vm_free(&vm);
+    remove(path);
+}
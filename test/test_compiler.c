@@ -5,16 +5,39 @@
 #include "object.h"
 
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 typedef struct {
     VM vm;
     Value result;
 } RunResult;
 
-static RunResult run_source_or_fail(const char *source) {
+typedef struct {
+    double heap_grow_factor;
+    size_t min_heap_size;
+    size_t nursery_size;
+    size_t slice_budget;
+    size_t slice_bytes;
+} GcConfig;
+
+static GcConfig default_gc_config(void) {
+    GcConfig config;
+    config.heap_grow_factor = GC_DEFAULT_HEAP_GROW_FACTOR;
+    config.min_heap_size = GC_DEFAULT_MIN_HEAP_SIZE;
+    config.nursery_size = GC_DEFAULT_NURSERY_SIZE;
+    config.slice_budget = GC_DEFAULT_SLICE_BUDGET;
+    config.slice_bytes = GC_DEFAULT_SLICE_BYTES;
+    return config;
+}
+
+static RunResult run_with_config(const char *source, GcConfig config) {
     RunResult run;
     vm_init(&run.vm);
+    vm_configure_gc(&run.vm, config.heap_grow_factor, config.min_heap_size);
+    vm_configure_nursery(&run.vm, config.nursery_size);
+    vm_configure_incremental(&run.vm, config.slice_budget, config.slice_bytes);
     run.result = value_make_null();
     char *error = NULL;
     bool ok = compiler_run_source(&run.vm, source, &run.result, &error);
@@ -28,6 +51,10 @@ static RunResult run_source_or_fail(const char *source) {
     return run;
 }
 
+static RunResult run_source_or_fail(const char *source) {
+    return run_with_config(source, default_gc_config());
+}
+
 static void expect_compile_failure(const char *source) {
     VM vm;
     vm_init(&vm);
@@ -54,6 +81,34 @@ static void assert_string(const char *expected, Value actual) {
     TEST_ASSERT_EQUAL_STRING(expected, string->chars);
 }
 
+static ObjFunction *compile_program(VM *vm, const char *source) {
+    char *error = NULL;
+    ObjFunction *function = compiler_compile_source(vm, source, &error);
+    if (!function) {
+        TEST_FAIL_MESSAGE(error ? error : "compiler_compile_source failed");
+    }
+    return function;
+}
+
+static size_t count_heap_objects(VM *vm) {
+    size_t count = 0;
+    for (Obj *object = heap_first(&vm->heap); object; object = heap_next(&vm->heap, object)) {
+        count++;
+    }
+    return count;
+}
+
+static ObjFunction *find_function(VM *vm, const char *name) {
+    for (Obj *object = heap_first(&vm->heap); object; object = heap_next(&vm->heap, object)) {
+        ObjFunction *function = (ObjFunction *)object;
+        if (object->type == OBJ_FUNCTION && function->name && strcmp(function->name->chars, name) == 0) {
+            return function;
+        }
+    }
+    TEST_FAIL_MESSAGE(name);
+    return NULL;
+}
+
 void test_compile_arithmetic_script(void) {
     const char *source =
         "let x = 41;\n"
@@ -159,3 +214,434 @@ void test_compile_constructor_cannot_return_value(void) {
 
     expect_compile_failure(source);
 }
+
+void test_compile_gc_stress_preserves_live_values(void) {
+    const char *source =
+        "class Pair {\n"
+        "  constructor(left, right) {\n"
+        "    this.left = left;\n"
+        "    this.right = right;\n"
+        "  }\n"
+        "  joined() {\n"
+        "    return this.left + this.right;\n"
+        "  }\n"
+        "}\n"
+        "let list = [1, 2];\n"
+        "let i = 0;\n"
+        "let text = \"\";\n"
+        "while (i < 50) {\n"
+        "  list += i;\n"
+        "  let p = Pair(\"a\", \"b\");\n"
+        "  text = p.joined() + text;\n"
+        "  i = i + 1;\n"
+        "}\n"
+        "list[51];\n";
+
+    GcConfig config = default_gc_config();
+    config.heap_grow_factor = 1.0;
+    config.min_heap_size = 0;
+    RunResult run = run_with_config(source, config);
+    assert_number(49.0, run.result);
+    vm_free(&run.vm);
+}
+
+void test_compile_minor_collections_preserve_old_to_young_references(void) {
+    const char *source =
+        "class Box {\n"
+        "  constructor() {\n"
+        "    this.items = [];\n"
+        "    this.last = \"\";\n"
+        "  }\n"
+        "  put(value) {\n"
+        "    let items = this.items;\n"
+        "    items += value;\n"
+        "    this.last = value;\n"
+        "  }\n"
+        "}\n"
+        "let box = Box();\n"
+        "let list = [];\n"
+        "let text = \"\";\n"
+        "let i = 0;\n"
+        "while (i < 200) {\n"
+        "  text = text + \"x\";\n"
+        "  box.put(text);\n"
+        "  list += [text];\n"
+        "  i = i + 1;\n"
+        "}\n"
+        "let r = 0;\n"
+        "if (box.last == list[199]) { r = r + 1; }\n"
+        "if (box.items[0] == \"x\") { r = r + 10; }\n"
+        "if (list[1] == box.items[1]) { r = r + 100; }\n"
+        "r;\n";
+
+    /* A minor collection before every allocation; the old generation is only collected at the default threshold. */
+    GcConfig config = default_gc_config();
+    config.nursery_size = 1;
+    RunResult run = run_with_config(source, config);
+    assert_number(111.0, run.result);
+    TEST_ASSERT_TRUE(run.vm.gc_minor_collections > 200);
+    vm_free(&run.vm);
+}
+
+void test_compile_incremental_collections_interleave_with_mutator(void) {
+    const char *source =
+        "class Node {\n"
+        "  constructor(value, next) {\n"
+        "    this.value = value;\n"
+        "    this.next = next;\n"
+        "  }\n"
+        "}\n"
+        "let head = null;\n"
+        "let keep = [];\n"
+        "let text = \"\";\n"
+        "let i = 0;\n"
+        "while (i < 300) {\n"
+        "  text = text + \"x\";\n"
+        "  head = Node(text, head);\n"
+        "  keep += [text];\n"
+        "  let garbage = [i, head, text + \"y\"];\n"
+        "  i = i + 1;\n"
+        "}\n"
+        "let total = 0;\n"
+        "let node = head;\n"
+        "let j = 299;\n"
+        "while (node != null) {\n"
+        "  if (node.value == keep[j]) { total = total + 1; }\n"
+        "  node = node.next;\n"
+        "  j = j - 1;\n"
+        "}\n"
+        "total;\n";
+
+    /* Full cycles back to back, advancing a few objects at every allocation. */
+    GcConfig config = default_gc_config();
+    config.heap_grow_factor = 1.0;
+    config.min_heap_size = 0;
+    config.slice_budget = 4;
+    config.slice_bytes = 1;
+    RunResult run = run_with_config(source, config);
+    assert_number(300.0, run.result);
+    TEST_ASSERT_TRUE(run.vm.gc_major_collections > 10);
+    TEST_ASSERT_TRUE(run.vm.gc_slices > run.vm.gc_major_collections * 2);
+    vm_free(&run.vm);
+}
+
+void test_compile_compound_append_mutates_in_place(void) {
+    const char *source =
+        "function fill(list, n) {\n"
+        "  let i = 0;\n"
+        "  while (i < n) {\n"
+        "    list += i;\n"
+        "    i += 1;\n"
+        "  }\n"
+        "  return list;\n"
+        "}\n"
+        "let list = [];\n"
+        "let alias = list;\n"
+        "fill(list, 1000);\n"
+        "alias += [alias[999]];\n"
+        "list += list;\n"
+        "let text = \"a\";\n"
+        "text += \"b\";\n"
+        "let copy = alias + 1;\n"
+        "copy += 2;\n"
+        "[alias == list, alias[2001], list[1500], text, copy[2002]];\n";
+
+    RunResult run = run_source_or_fail(source);
+    TEST_ASSERT_TRUE(value_is_array(run.result));
+    ObjArray *result = value_as_array(run.result);
+    TEST_ASSERT_EQUAL_UINT(5, result->elements.count);
+    TEST_ASSERT_TRUE(value_is_bool(result->elements.values[0]) && value_as_bool(result->elements.values[0]));
+    assert_number(999.0, result->elements.values[1]);
+    assert_number(499.0, result->elements.values[2]);
+    assert_string("ab", result->elements.values[3]);
+    assert_number(1.0, result->elements.values[4]);
+    vm_free(&run.vm);
+}
+
+void test_compile_inline_caches_handle_polymorphic_sites(void) {
+    const char *source =
+        "class Box {\n"
+        "  constructor(v) {\n"
+        "    this.v = v;\n"
+        "  }\n"
+        "  get() {\n"
+        "    return this.v;\n"
+        "  }\n"
+        "}\n"
+        "function read(o) {\n"
+        "  return o.get() + o.v;\n"
+        "}\n"
+        "let boxes = [Box(1), Box(2), Box(3), Box(4), Box(5), Box(6)];\n"
+        "boxes[1].w = 0;\n"
+        "boxes[2].x = 0;\n"
+        "boxes[3].y = 0;\n"
+        "boxes[4].z = 0;\n"
+        "boxes[5].v = 6;\n"
+        "let total = 0;\n"
+        "let round = 0;\n"
+        "while (round < 10) {\n"
+        "  let i = 0;\n"
+        "  while (i < 6) {\n"
+        "    total = total + read(boxes[i]);\n"
+        "    i = i + 1;\n"
+        "  }\n"
+        "  round = round + 1;\n"
+        "}\n"
+        "total;\n";
+
+    RunResult run = run_source_or_fail(source);
+    assert_number(420.0, run.result);
+    TEST_ASSERT_TRUE(run.vm.ic_hits > 0);
+    TEST_ASSERT_TRUE(run.vm.ic_misses > 0);
+    vm_free(&run.vm);
+}
+
+void test_compile_method_invocation_does_not_allocate(void) {
+    const char *source =
+        "class Counter {\n"
+        "  constructor() {\n"
+        "    this.count = 0;\n"
+        "  }\n"
+        "  add(n) {\n"
+        "    this.count = this.count + n;\n"
+        "  }\n"
+        "}\n"
+        "let counter = Counter();\n"
+        "let i = 0;\n"
+        "while (i < 10000) {\n"
+        "  counter.add(2);\n"
+        "  i = i + 1;\n"
+        "}\n"
+        "let add = counter.add;\n"
+        "add(1);\n"
+        "counter.count;\n";
+
+    /* No collections at all, so every object the loop allocated would still be on the heap. */
+    GcConfig config = default_gc_config();
+    config.min_heap_size = SIZE_MAX;
+    config.nursery_size = 0;
+    RunResult run = run_with_config(source, config);
+    assert_number(20001.0, run.result);
+    TEST_ASSERT_TRUE(count_heap_objects(&run.vm) < 100);
+    vm_free(&run.vm);
+}
+
+void test_compile_records_source_lines(void) {
+    const char *source =
+        "let a = 1;\n"
+        "\n"
+        "let b = a +\n"
+        "  2;\n";
+
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = compile_program(&vm, source);
+
+    Chunk *chunk = &function->chunk;
+    TEST_ASSERT_EQUAL_INT(1, chunk_get_line(chunk, 0));
+    bool saw_line_three = false;
+    for (int offset = 0; offset < chunk->count; offset++) {
+        int line = chunk_get_line(chunk, offset);
+        TEST_ASSERT_TRUE(line >= 1 && line <= 4);
+        saw_line_three |= line == 3;
+    }
+    TEST_ASSERT_TRUE(saw_line_three);
+    TEST_ASSERT_TRUE(chunk->line_count < chunk->count);
+    vm_free(&vm);
+
+    char *error = NULL;
+    Program *program = parser_parse("let x = 1;\nlet y = ;\n", &error);
+    TEST_ASSERT_NULL(program);
+    TEST_ASSERT_NOT_NULL(strstr(error, "[line 2]"));
+    free(error);
+}
+
+void test_compile_deduplicates_constants(void) {
+    const char *source =
+        "class Point {\n"
+        "  constructor() {\n"
+        "    this.x = 1;\n"
+        "  }\n"
+        "  sum() {\n"
+        "    return this.x + this.x + this.x + this.x + this.x + 1 + 1 + 1;\n"
+        "  }\n"
+        "}\n"
+        "Point().sum();\n";
+
+    VM vm;
+    vm_init(&vm);
+    compile_program(&vm, source);
+    ObjFunction *sum = find_function(&vm, "sum");
+    TEST_ASSERT_EQUAL_INT(2, (int)sum->chunk.constants.count);
+    vm_free(&vm);
+}
+
+void test_compile_fuses_compare_and_branch(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *script = compile_program(&vm, "let i = 0;\nwhile (i < 10) { i = i + 1; }\ni;\n");
+    /* LOAD_CONST, DEFINE_GLOBAL, then the loop header: GET_GLOBAL and one branch. */
+    TEST_ASSERT_EQUAL_INT(OP_GET_GLOBAL, script->chunk.code[8]);
+    TEST_ASSERT_EQUAL_INT(OP_JUMP_IF_GE_K, script->chunk.code[12]);
+    vm_free(&vm);
+
+    const char *source =
+        "let nan = 0 / 0;\n"
+        "let r = 0;\n"
+        "if (nan <= 1) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (nan >= 1) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (nan < 1) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (1 <= nan) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (3 > 2) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (2 >= 3) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (\"a\" == \"a\") { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "if (\"a\" != 1) { r = r * 2 + 1; } else { r = r * 2; }\n"
+        "let i = 0;\n"
+        "while (10 > i) { i = i + 1; }\n"
+        "r * 100 + i;\n";
+    RunResult run = run_source_or_fail(source);
+    /* Bits 1,1,0,1,1,0,1,1: `<=`/`>=` stay the negations of `>`/`<` under NaN. */
+    assert_number(21910, run.result);
+    vm_free(&run.vm);
+
+    expect_compile_failure("if (\"a\" < 1) { 1; }");
+}
+
+void test_compile_reads_literal_operands_from_constants(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *script = compile_program(&vm, "let x = 2;\nx * 3 + 1;\n");
+    /* LOAD_CONST, DEFINE_GLOBAL, GET_GLOBAL, then no loads for 3 and 1. */
+    TEST_ASSERT_EQUAL_INT(OP_MULTIPLY_K, script->chunk.code[12]);
+    TEST_ASSERT_EQUAL_INT(OP_ADD_K, script->chunk.code[17]);
+    vm_free(&vm);
+
+    RunResult run = run_source_or_fail("let x = 2;\nx * 3 + 1;\n");
+    assert_number(7, run.result);
+    vm_free(&run.vm);
+
+    run = run_source_or_fail("let s = \"ab\";\ns + \"c\";\n");
+    assert_string("abc", run.result);
+    vm_free(&run.vm);
+
+    run = run_source_or_fail("let a = [1];\n(a + 2)[1];\n");
+    assert_number(2, run.result);
+    vm_free(&run.vm);
+
+    /* Compound assignment takes the constant form too, whatever the target holds. */
+    vm_init(&vm);
+    script = compile_program(&vm, "let x = 2;\nx += 3;\n");
+    TEST_ASSERT_EQUAL_INT(OP_APPEND_K, script->chunk.code[12]);
+    vm_free(&vm);
+
+    run = run_source_or_fail("let x = 2;\nlet a = [1];\nx += 3;\na += 5;\nx + a[1];\n");
+    assert_number(10, run.result);
+    vm_free(&run.vm);
+
+    run = run_source_or_fail("let s = \"a\";\ns += \"b\";\ns;\n");
+    assert_string("ab", run.result);
+    vm_free(&run.vm);
+
+    run = run_source_or_fail(
+        "let x = 4;\n"
+        "let r = 0;\n"
+        "if (1 < x) { r = 10 - x; }\n"
+        "let ge = 2 >= x;\n"
+        "let ne = x != \"4\";\n"
+        "if (!ge) { r = r + 10; }\n"
+        "if (ne) { r = r + 100; }\n"
+        "r;\n");
+    assert_number(116, run.result);
+    vm_free(&run.vm);
+
+    expect_compile_failure("let s = \"a\";\ns - 1;\n");
+}
+
+void test_compile_reads_locals_in_place(void) {
+    const char *source =
+        "function scale(a, b) {\n"
+        "  let c = a * b;\n"
+        "  c = c + a;\n"
+        "  return c;\n"
+        "}\n"
+        "scale(3, 4);\n";
+
+    VM vm;
+    vm_init(&vm);
+    compile_program(&vm, source);
+    ObjFunction *scale = find_function(&vm, "scale");
+    /* MULTIPLY c, a, b; ADD c, c, a; RETURN c: no copies and no temporaries. */
+    const uint8_t expected[] = {OP_MULTIPLY, 2, 0, 1, OP_ADD, 2, 2, 0, OP_RETURN, 2};
+    TEST_ASSERT_TRUE(scale->chunk.count >= (int)sizeof(expected));
+    TEST_ASSERT_TRUE(memcmp(expected, scale->chunk.code, sizeof(expected)) == 0);
+    TEST_ASSERT_EQUAL_INT(3, scale->register_count);
+    vm_free(&vm);
+
+    /* Reads of a local are not deferred past a later assignment to it. */
+    RunResult run = run_source_or_fail(
+        "function f(a, b, c) { return a * 100 + b * 10 + c; }\n"
+        "function g() {\n"
+        "  let x = 1;\n"
+        "  let r = f(x, x = 2, x);\n"
+        "  let y = 5;\n"
+        "  return r * 100 + (y + (y = 7) + y);\n"
+        "}\n"
+        "g();\n");
+    assert_number(12219, run.result);
+    vm_free(&run.vm);
+}
+
+void test_compile_peephole_branches_on_negated_condition(void) {
+    const char *source =
+        "function pick(x) {\n"
+        "  if (!x) { return 1; }\n"
+        "  return 2;\n"
+        "}\n"
+        "pick(false) * 10 + pick(3);\n";
+
+    VM vm;
+    vm_init(&vm);
+    compile_program(&vm, source);
+    ObjFunction *pick = find_function(&vm, "pick");
+    /* JUMP_IF_TRUE x replaces NOT + JUMP_IF_FALSE; the code after each RETURN is gone. */
+    const uint8_t expected[] = {OP_JUMP_IF_TRUE, 0, 0, 6, OP_LOAD_CONST, 1, 0, 0,
+                                OP_RETURN, 1, OP_LOAD_CONST, 1, 0, 1, OP_RETURN, 1};
+    TEST_ASSERT_EQUAL_INT((int)sizeof(expected), pick->chunk.count);
+    TEST_ASSERT_TRUE(memcmp(expected, pick->chunk.code, sizeof(expected)) == 0);
+    vm_free(&vm);
+
+    RunResult run = run_source_or_fail(source);
+    assert_number(12, run.result);
+    vm_free(&run.vm);
+}
+
+void test_compile_folds_literal_expressions(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *script = compile_program(&vm, "let day = 60 * 60 * 24;\nlet ab = \"a\" + \"b\";\nlet no = !true;\n");
+    Chunk *chunk = &script->chunk;
+    /* LOAD_CONST/DEFINE_GLOBAL twice, then LOAD_FALSE/DEFINE_GLOBAL. */
+    TEST_ASSERT_EQUAL_INT(OP_LOAD_CONST, chunk->code[0]);
+    TEST_ASSERT_EQUAL_INT(OP_DEFINE_GLOBAL, chunk->code[4]);
+    TEST_ASSERT_EQUAL_INT(OP_LOAD_CONST, chunk->code[8]);
+    TEST_ASSERT_EQUAL_INT(OP_DEFINE_GLOBAL, chunk->code[12]);
+    TEST_ASSERT_EQUAL_INT(OP_LOAD_FALSE, chunk->code[16]);
+    TEST_ASSERT_EQUAL_INT(2, (int)chunk->constants.count);
+    assert_number(86400, chunk->constants.values[0]);
+    assert_string("ab", chunk->constants.values[1]);
+    vm_free(&vm);
+
+    /* Folded results match the VM, including NaN and `<=` as `!(a > b)`. */
+    RunResult run = run_source_or_fail(
+        "let n = 0 / 0;\n"
+        "let r = 0;\n"
+        "if (0 / 0 <= 1) { r = r + 1; }\n"
+        "if (n != n) { r = r + 10; }\n"
+        "if (\"x\" + \"y\" == \"xy\") { r = r + 100; }\n"
+        "r + -(2 - 3) * 1000;\n");
+    assert_number(1111, run.result);
+    vm_free(&run.vm);
+
+    /* Operations the VM rejects are left for run time. */
+    expect_compile_failure("let bad = 1 + \"a\";\n");
+}
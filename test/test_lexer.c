@@ -12,42 +12,43 @@ void tearDown(void) {
     // Tear down code here (runs after each test)
 }
 
+static void assert_lexeme(const char *expected, const Token *token) {
+    char buffer[64];
+    TEST_ASSERT_NOT_NULL(token->start);
+    TEST_ASSERT_TRUE(token->length < sizeof(buffer));
+    memcpy(buffer, token->start, token->length);
+    buffer[token->length] = '\0';
+    TEST_ASSERT_EQUAL_STRING(expected, buffer);
+}
+
 static void expect_simple_token(Lexer *lexer, TokenType expected_type, const char *expected_lexeme) {
     Token token = lexer_next_token(lexer);
     TEST_ASSERT_EQUAL_INT(expected_type, token.type);
     if (expected_lexeme != NULL) {
-        TEST_ASSERT_NOT_NULL(token.lexeme);
-        TEST_ASSERT_EQUAL_STRING(expected_lexeme, token.lexeme);
+        assert_lexeme(expected_lexeme, &token);
     }
-    token_free(&token);
 }
 
 static void expect_number_token(Lexer *lexer, double expected_value, const char *expected_lexeme) {
     Token token = lexer_next_token(lexer);
     TEST_ASSERT_EQUAL_INT(TOKEN_NUMBER, token.type);
-    TEST_ASSERT_NOT_NULL(token.lexeme);
     if (expected_lexeme != NULL) {
-        TEST_ASSERT_EQUAL_STRING(expected_lexeme, token.lexeme);
+        assert_lexeme(expected_lexeme, &token);
     }
     double diff = fabs(token.number_value - expected_value);
     TEST_ASSERT_TRUE_MESSAGE(diff < 1e-9, "Number literal mismatch");
-    token_free(&token);
 }
 
 static void expect_string_token(Lexer *lexer, const char *expected_value) {
     Token token = lexer_next_token(lexer);
     TEST_ASSERT_EQUAL_INT(TOKEN_STRING, token.type);
-    TEST_ASSERT_NOT_NULL(token.lexeme);
-    TEST_ASSERT_EQUAL_STRING(expected_value, token.lexeme);
-    token_free(&token);
+    assert_lexeme(expected_value, &token);
 }
 
 static void expect_eof(Lexer *lexer) {
     Token token = lexer_next_token(lexer);
     TEST_ASSERT_EQUAL_INT(TOKEN_EOF, token.type);
-    TEST_ASSERT_NOT_NULL(token.lexeme);
-    TEST_ASSERT_EQUAL_UINT(0U, (unsigned int)strlen(token.lexeme));
-    token_free(&token);
+    TEST_ASSERT_EQUAL_UINT(0U, (unsigned int)token.length);
 }
 
 void test_lex_simple_declaration(void) {
@@ -271,3 +272,40 @@ void test_lex_class_and_member_access(void) {
 }
 
 
+
+void test_lex_tracks_line_numbers(void) {
+    const char *source =
+        "let a = 1;\n"
+        "// comment\n"
+        "\n"
+        "a = \"text\";\n";
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+
+    const int expected_lines[] = {1, 1, 1, 1, 1, 4, 4, 4, 4, 5};
+    for (size_t i = 0; i < sizeof(expected_lines) / sizeof(expected_lines[0]); i++) {
+        Token token = lexer_next_token(&lexer);
+        TEST_ASSERT_EQUAL_INT(expected_lines[i], token.line);
+    }
+}
+
+void test_lex_tokens_slice_the_source(void) {
+    const char *source = "value 12.5e3 \"hi there\"";
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+
+    Token name = lexer_next_token(&lexer);
+    TEST_ASSERT_TRUE(name.start == source);
+    TEST_ASSERT_EQUAL_UINT(5U, (unsigned int)name.length);
+
+    expect_number_token(&lexer, 12.5, "12.5");
+    expect_simple_token(&lexer, TOKEN_IDENTIFIER, "e3");
+
+    Token text = lexer_next_token(&lexer);
+    TEST_ASSERT_EQUAL_INT(TOKEN_STRING, text.type);
+    TEST_ASSERT_TRUE(text.start == source + 14);
+    assert_lexeme("hi there", &text);
+    expect_eof(&lexer);
+}
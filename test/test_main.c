@@ -7,6 +7,8 @@ extern void test_lex_function_declaration(void);
 extern void test_lex_boolean_and_null_literals(void);
 extern void test_lex_array_and_plus_equal(void);
 extern void test_lex_class_and_member_access(void);
+extern void test_lex_tracks_line_numbers(void);
+extern void test_lex_tokens_slice_the_source(void);
 extern void test_parse_variable_declarations(void);
 extern void test_parse_assignment_statement(void);
 extern void test_parse_if_else(void);
@@ -17,6 +19,7 @@ extern void test_parse_call_expression(void);
 extern void test_parse_array_literal_and_index(void);
 extern void test_parse_class_declaration(void);
 extern void test_parser_reports_error(void);
+extern void test_parse_arena_allocations(void);
 extern void test_compile_arithmetic_script(void);
 extern void test_compile_if_else_script(void);
 extern void test_compile_function_call_script(void);
@@ -25,6 +28,19 @@ extern void test_compile_string_concatenation_script(void);
 extern void test_compile_array_literal_script(void);
 extern void test_compile_class_methods_script(void);
 extern void test_compile_constructor_cannot_return_value(void);
+extern void test_compile_gc_stress_preserves_live_values(void);
+extern void test_compile_minor_collections_preserve_old_to_young_references(void);
+extern void test_compile_incremental_collections_interleave_with_mutator(void);
+extern void test_compile_compound_append_mutates_in_place(void);
+extern void test_compile_inline_caches_handle_polymorphic_sites(void);
+extern void test_compile_method_invocation_does_not_allocate(void);
+extern void test_compile_records_source_lines(void);
+extern void test_compile_deduplicates_constants(void);
+extern void test_compile_fuses_compare_and_branch(void);
+extern void test_compile_reads_literal_operands_from_constants(void);
+extern void test_compile_reads_locals_in_place(void);
+extern void test_compile_peephole_branches_on_negated_condition(void);
+extern void test_compile_folds_literal_expressions(void);
 extern void test_vm_arithmetic_addition(void);
 extern void test_vm_global_roundtrip(void);
 extern void test_vm_locals_and_control_flow(void);
@@ -48,6 +64,27 @@ extern void test_vm_runtime_error_call_non_function(void);
 extern void test_vm_runtime_error_undefined_global(void);
 extern void test_vm_global_string_roundtrip(void);
 extern void test_vm_garbage_collection_reclaims_unreferenced_strings(void);
+extern void test_vm_allocation_triggers_collection(void);
+extern void test_vm_minor_collection_promotes_survivors(void);
+extern void test_vm_minor_collection_scans_only_written_old_roots(void);
+extern void test_vm_incremental_barrier_shades_stores_into_black_objects(void);
+extern void test_vm_lazy_sweep_reuses_dead_objects(void);
+extern void test_vm_heap_groups_objects_by_size_class(void);
+extern void test_vm_strings_store_characters_inline(void);
+extern void test_vm_intern_table_reuses_tombstones(void);
+extern void test_vm_value_representation_round_trips(void);
+extern void test_vm_instances_share_shapes(void);
+extern void test_vm_well_known_names_and_constructor_slot(void);
+extern void test_vm_chunk_lines_are_run_length_encoded(void);
+extern void test_vm_chunk_deduplicates_constants(void);
+extern void test_vm_quickens_and_dequickens_binary_ops(void);
+extern void test_vm_append_quickens_numbers_and_extends_arrays_in_place(void);
+extern void test_vm_peephole_cleans_up_chunk(void);
+extern void test_vm_peephole_verify_rejects_out_of_range_operands(void);
+extern void test_bytecode_round_trip_runs(void);
+extern void test_bytecode_rejects_stale_or_corrupt_images(void);
+extern void test_bytecode_rejects_nan_tagged_constants(void);
+extern void test_bytecode_file_cache_round_trip(void);
 
 int main(void) {
     UNITY_BEGIN();
@@ -58,6 +95,8 @@ int main(void) {
     RUN_TEST(test_lex_boolean_and_null_literals);
     RUN_TEST(test_lex_array_and_plus_equal);
     RUN_TEST(test_lex_class_and_member_access);
+    RUN_TEST(test_lex_tracks_line_numbers);
+    RUN_TEST(test_lex_tokens_slice_the_source);
     RUN_TEST(test_parse_variable_declarations);
     RUN_TEST(test_parse_assignment_statement);
     RUN_TEST(test_parse_if_else);
@@ -68,6 +107,7 @@ int main(void) {
     RUN_TEST(test_parse_array_literal_and_index);
     RUN_TEST(test_parse_class_declaration);
     RUN_TEST(test_parser_reports_error);
+    RUN_TEST(test_parse_arena_allocations);
     RUN_TEST(test_compile_arithmetic_script);
     RUN_TEST(test_compile_if_else_script);
     RUN_TEST(test_compile_function_call_script);
@@ -76,6 +116,19 @@ int main(void) {
     RUN_TEST(test_compile_array_literal_script);
     RUN_TEST(test_compile_class_methods_script);
     RUN_TEST(test_compile_constructor_cannot_return_value);
+    RUN_TEST(test_compile_gc_stress_preserves_live_values);
+    RUN_TEST(test_compile_minor_collections_preserve_old_to_young_references);
+    RUN_TEST(test_compile_incremental_collections_interleave_with_mutator);
+    RUN_TEST(test_compile_compound_append_mutates_in_place);
+    RUN_TEST(test_compile_inline_caches_handle_polymorphic_sites);
+    RUN_TEST(test_compile_method_invocation_does_not_allocate);
+    RUN_TEST(test_compile_records_source_lines);
+    RUN_TEST(test_compile_deduplicates_constants);
+    RUN_TEST(test_compile_fuses_compare_and_branch);
+    RUN_TEST(test_compile_reads_literal_operands_from_constants);
+    RUN_TEST(test_compile_reads_locals_in_place);
+    RUN_TEST(test_compile_peephole_branches_on_negated_condition);
+    RUN_TEST(test_compile_folds_literal_expressions);
     RUN_TEST(test_vm_arithmetic_addition);
     RUN_TEST(test_vm_global_roundtrip);
     RUN_TEST(test_vm_locals_and_control_flow);
@@ -99,5 +152,26 @@ int main(void) {
     RUN_TEST(test_vm_runtime_error_undefined_global);
     RUN_TEST(test_vm_global_string_roundtrip);
     RUN_TEST(test_vm_garbage_collection_reclaims_unreferenced_strings);
+    RUN_TEST(test_vm_allocation_triggers_collection);
+    RUN_TEST(test_vm_minor_collection_promotes_survivors);
+    RUN_TEST(test_vm_minor_collection_scans_only_written_old_roots);
+    RUN_TEST(test_vm_incremental_barrier_shades_stores_into_black_objects);
+    RUN_TEST(test_vm_lazy_sweep_reuses_dead_objects);
+    RUN_TEST(test_vm_heap_groups_objects_by_size_class);
+    RUN_TEST(test_vm_strings_store_characters_inline);
+    RUN_TEST(test_vm_intern_table_reuses_tombstones);
+    RUN_TEST(test_vm_value_representation_round_trips);
+    RUN_TEST(test_vm_instances_share_shapes);
+    RUN_TEST(test_vm_well_known_names_and_constructor_slot);
+    RUN_TEST(test_vm_chunk_lines_are_run_length_encoded);
+    RUN_TEST(test_vm_chunk_deduplicates_constants);
+    RUN_TEST(test_vm_quickens_and_dequickens_binary_ops);
+    RUN_TEST(test_vm_append_quickens_numbers_and_extends_arrays_in_place);
+    RUN_TEST(test_vm_peephole_cleans_up_chunk);
+    RUN_TEST(test_vm_peephole_verify_rejects_out_of_range_operands);
+    RUN_TEST(test_bytecode_round_trip_runs);
+    RUN_TEST(test_bytecode_rejects_stale_or_corrupt_images);
+    RUN_TEST(test_bytecode_rejects_nan_tagged_constants);
+    RUN_TEST(test_bytecode_file_cache_round_trip);
     return UNITY_END();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "../src/parser.h"
 
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -297,3 +298,34 @@ void test_parser_reports_error(void) {
 
     free(error);
 }
+
+void test_parse_arena_allocations(void) {
+    Arena arena;
+    arena_init(&arena);
+
+    char *first = (char *)arena_alloc(&arena, 3);
+    double *aligned = (double *)arena_alloc(&arena, sizeof(double));
+    TEST_ASSERT_EQUAL_INT(0, (int)((uintptr_t)aligned % sizeof(double)));
+    TEST_ASSERT_EQUAL_INT(0, first[0] | first[1] | first[2]);
+
+    int *items = (int *)arena_alloc(&arena, 4 * sizeof(int));
+    for (int i = 0; i < 4; i++) {
+        items[i] = i;
+    }
+    int *grown = (int *)arena_grow(&arena, items, 4 * sizeof(int), 8 * sizeof(int));
+    TEST_ASSERT_TRUE(grown == items);
+    arena_alloc(&arena, 1);
+    grown = (int *)arena_grow(&arena, items, 8 * sizeof(int), 16 * sizeof(int));
+    TEST_ASSERT_TRUE(grown != items);
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT(i, grown[i]);
+    }
+
+    char *big = (char *)arena_alloc(&arena, 1024 * 1024);
+    big[1024 * 1024 - 1] = 'x';
+    char *copy = arena_copy_string(&arena, "name", 4);
+    TEST_ASSERT_EQUAL_STRING("name", copy);
+
+    arena_free(&arena);
+    TEST_ASSERT_NULL(arena.head);
+}
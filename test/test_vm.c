@@ -1,11 +1,14 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "../libs/Unity/src/unity.h"
 
 #include "chunk.h"
+#include "heap.h"
 #include "object.h"
+#include "peephole.h"
 #include "value.h"
 #include "vm.h"
 
@@ -21,14 +24,22 @@ static void ensure_register_count(ObjFunction *function, int required) {
     }
 }
 
-static void write_load_const(Chunk *chunk, uint8_t dest, Value value, int line) {
-    uint16_t index = add_constant(chunk, value, line);
+static void write_load_index(Chunk *chunk, uint8_t dest, uint16_t index, int line) {
     chunk_write(chunk, OP_LOAD_CONST, line);
     chunk_write(chunk, dest, line);
     chunk_write(chunk, (uint8_t)((index >> 8) & 0xFF), line);
     chunk_write(chunk, (uint8_t)(index & 0xFF), line);
 }
 
+static void write_load_const(Chunk *chunk, uint8_t dest, Value value, int line) {
+    write_load_index(chunk, dest, add_constant(chunk, value, line), line);
+}
+
+static void patch_load_index(Chunk *chunk, int offset, uint16_t index) {
+    chunk->code[offset + 2] = (uint8_t)((index >> 8) & 0xFF);
+    chunk->code[offset + 3] = (uint8_t)(index & 0xFF);
+}
+
 static void write_load_bool(Chunk *chunk, uint8_t dest, bool value, int line) {
     chunk_write(chunk, value ? OP_LOAD_TRUE : OP_LOAD_FALSE, line);
     chunk_write(chunk, dest, line);
@@ -388,7 +399,7 @@ void test_vm_string_literal(void) {
     ObjFunction *function = obj_function_new(&vm, "main", 0);
     Chunk *chunk = &function->chunk;
 
-    write_load_const(chunk, 0, make_string_value(&vm, "hello"), 1);
+    write_load_index(chunk, 0, obj_function_add_constant(&vm, function, make_string_value(&vm, "hello")), 1);
     write_return(chunk, 0, 1);
     ensure_register_count(function, 1);
 
@@ -406,8 +417,8 @@ void test_vm_string_concatenation(void) {
     ObjFunction *function = obj_function_new(&vm, "main", 0);
     Chunk *chunk = &function->chunk;
 
-    write_load_const(chunk, 0, make_string_value(&vm, "foo"), 1);
-    write_load_const(chunk, 1, make_string_value(&vm, "bar"), 1);
+    write_load_index(chunk, 0, obj_function_add_constant(&vm, function, make_string_value(&vm, "foo")), 1);
+    write_load_index(chunk, 1, obj_function_add_constant(&vm, function, make_string_value(&vm, "bar")), 1);
     write_binary(chunk, OP_ADD, 0, 0, 1, 1);
     write_return(chunk, 0, 1);
     ensure_register_count(function, 2);
@@ -580,7 +591,7 @@ void test_vm_global_string_roundtrip(void) {
     ObjFunction *function = obj_function_new(&vm, "script", 0);
     Chunk *chunk = &function->chunk;
 
-    write_load_const(chunk, 0, make_string_value(&vm, "alpha"), 1);
+    write_load_index(chunk, 0, obj_function_add_constant(&vm, function, make_string_value(&vm, "alpha")), 1);
     write_define_global(chunk, 0, 0, 1);
     write_get_global(chunk, 1, 0, 1);
     write_return(chunk, 1, 1);
@@ -648,3 +659,636 @@ void test_vm_garbage_collection_reclaims_unreferenced_strings(void) {
     vm_pop(&vm);
     vm_free(&vm);
 }
+
+void test_vm_allocation_triggers_collection(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_gc(&vm, 2.0, 16 * 1024);
+
+    Value root_value = make_string_value(&vm, "survivor");
+    vm_push(&vm, root_value);
+
+    char buffer[32];
+    for (int i = 0; i < 20000; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "garbage-%d", i);
+        obj_string_copy(&vm, buffer, (size_t)length);
+        TEST_ASSERT_TRUE(vm.bytes_allocated <= 64 * 1024);
+    }
+
+    const char *text = "survivor";
+    size_t length = strlen(text);
+    TEST_ASSERT_TRUE(table_find_string(&vm.strings, text, length, hash_bytes(text, length)) == value_as_string(root_value));
+
+    vm_pop(&vm);
+    vm_free(&vm);
+}
+
+void test_vm_minor_collection_promotes_survivors(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_nursery(&vm, 0);
+    size_t minor_collections = vm.gc_minor_collections;
+
+    ObjArray *array = obj_array_new(&vm);
+    vm_push(&vm, value_make_array(array));
+    TEST_ASSERT_TRUE(obj_is_young(&array->obj));
+    vm_collect_nursery(&vm);
+    TEST_ASSERT_FALSE(obj_is_young(&array->obj));
+    TEST_ASSERT_NULL(vm.young_objects);
+
+    /* The only reference to "young" is from the old array, recorded by the barrier. */
+    obj_array_append(&vm, array, make_string_value(&vm, "young"));
+    TEST_ASSERT_TRUE(array->obj.remembered);
+    obj_string_copy(&vm, "garbage", 7);
+    vm_collect_nursery(&vm);
+    TEST_ASSERT_FALSE(array->obj.remembered);
+    TEST_ASSERT_EQUAL_UINT(minor_collections + 2, vm.gc_minor_collections);
+
+    ObjString *young = table_find_string(&vm.strings, "young", 5, hash_bytes("young", 5));
+    TEST_ASSERT_TRUE(young && value_as_string(array->elements.values[0]) == young);
+    TEST_ASSERT_FALSE(obj_is_young(&young->obj));
+    TEST_ASSERT_NULL(table_find_string(&vm.strings, "garbage", 7, hash_bytes("garbage", 7)));
+
+    /* A full collection still frees old objects once they become unreachable. */
+    vm_pop(&vm);
+    vm_collect_garbage(&vm);
+    TEST_ASSERT_NULL(table_find_string(&vm.strings, "young", 5, hash_bytes("young", 5)));
+    TEST_ASSERT_EQUAL_UINT(1, vm.gc_major_collections);
+
+    vm_free(&vm);
+}
+
+void test_vm_minor_collection_scans_only_written_old_roots(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_gc(&vm, 2.0, SIZE_MAX);
+    vm_configure_nursery(&vm, 0);
+    ObjFunction *function = obj_function_new(&vm, "main", 0);
+    vm_push(&vm, value_make_function(function));
+    vm_collect_nursery(&vm);
+    TEST_ASSERT_FALSE(function->obj.remembered);
+
+    /* A young constant puts the function in the remembered set until one minor collection has promoted it. */
+    Value constant = make_string_value(&vm, "constant");
+    obj_function_add_constant(&vm, function, constant);
+    TEST_ASSERT_TRUE(function->obj.remembered);
+    vm_collect_nursery(&vm);
+    TEST_ASSERT_FALSE(function->obj.remembered);
+    TEST_ASSERT_FALSE(obj_is_young(value_as_obj(constant)));
+    TEST_ASSERT_TRUE(value_as_string(constant) == obj_string_copy(&vm, "constant", 8));
+
+    /* Globals are scanned only across the slots that received young objects. */
+    Chunk *chunk = &function->chunk;
+    write_build_array(chunk, 0, NULL, 0, 1);
+    write_define_global(chunk, 0, 3, 1);
+    write_return(chunk, 0, 1);
+    ensure_register_count(function, 1);
+    Value result = value_make_null();
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    TEST_ASSERT_EQUAL_UINT(3, vm.globals_dirty_from);
+    TEST_ASSERT_EQUAL_UINT(4, vm.globals_dirty_to);
+    vm_collect_nursery(&vm);
+    TEST_ASSERT_FALSE(obj_is_young(value_as_obj(vm.globals[3])));
+    TEST_ASSERT_TRUE(vm.globals_dirty_from > vm.globals_dirty_to);
+
+    vm_free(&vm);
+}
+
+static bool gray_stack_contains(const VM *vm, const Obj *object) {
+    for (int i = 0; i < vm->gray_count; ++i) {
+        if (vm->gray_stack[i] == object) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_vm_incremental_barrier_shades_stores_into_black_objects(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_nursery(&vm, 0);
+    /* One object per slice, and no slices triggered by the allocations below. */
+    vm_configure_incremental(&vm, 1, SIZE_MAX / 2);
+
+    ObjArray *array = obj_array_new(&vm);
+    vm_push(&vm, value_make_array(array));
+    obj_array_append(&vm, array, make_string_value(&vm, "kept"));
+    vm_collect_garbage(&vm);
+    size_t major_collections = vm.gc_major_collections;
+
+    /* Step until the array is black while its element is still waiting on the gray stack. */
+    int steps = 0;
+    do {
+        vm_collect_step(&vm);
+        steps++;
+    } while (steps < 1000 && vm.gc_phase == GC_PHASE_MARKING &&
+             (array->obj.mark != vm.gc_epoch || gray_stack_contains(&vm, &array->obj)));
+    TEST_ASSERT_EQUAL_INT(GC_PHASE_MARKING, vm.gc_phase);
+
+    /* The string is only reachable from the black array, which is not scanned again. */
+    ObjString *late = obj_string_copy(&vm, "late", 4);
+    TEST_ASSERT_TRUE(obj_is_young(&late->obj));
+    obj_array_append(&vm, array, value_make_string(late));
+    TEST_ASSERT_EQUAL_UINT(vm.gc_epoch, late->obj.mark);
+
+    while (vm.gc_phase != GC_PHASE_IDLE) {
+        vm_collect_step(&vm);
+    }
+    TEST_ASSERT_EQUAL_UINT(major_collections + 1, vm.gc_major_collections);
+    TEST_ASSERT_TRUE(table_find_string(&vm.strings, "late", 4, hash_bytes("late", 4)) == late);
+    TEST_ASSERT_TRUE(value_as_string(array->elements.values[1]) == late);
+    TEST_ASSERT_FALSE(obj_is_young(&late->obj));
+
+    vm_pop(&vm);
+    vm_free(&vm);
+}
+
+void test_vm_lazy_sweep_reuses_dead_objects(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_nursery(&vm, 0);
+    vm_configure_incremental(&vm, 0, GC_DEFAULT_SLICE_BYTES);
+    vm_collect_garbage(&vm);
+    size_t major_collections = vm.gc_major_collections;
+    uintptr_t dead = (uintptr_t)obj_string_copy(&vm, "dead", 4);
+
+    /* Marking finishes in one step; sweeping is left to later allocations. */
+    vm_collect_step(&vm);
+    TEST_ASSERT_EQUAL_INT(GC_PHASE_SWEEPING, vm.gc_phase);
+    TEST_ASSERT_EQUAL_UINT(major_collections, vm.gc_major_collections);
+    TEST_ASSERT_NULL(table_find_string(&vm.strings, "dead", 4, hash_bytes("dead", 4)));
+
+    char buffer[32];
+    bool reused = false;
+    for (int i = 0; i < 1000 && vm.gc_phase == GC_PHASE_SWEEPING; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "fresh-%d", i);
+        ObjString *fresh = obj_string_copy(&vm, buffer, (size_t)length);
+        reused = reused || (uintptr_t)fresh == dead;
+    }
+    TEST_ASSERT_EQUAL_INT(GC_PHASE_IDLE, vm.gc_phase);
+    TEST_ASSERT_EQUAL_UINT(major_collections + 1, vm.gc_major_collections);
+    TEST_ASSERT_TRUE(reused);
+
+    vm_free(&vm);
+}
+
+void test_vm_heap_groups_objects_by_size_class(void) {
+    Heap heap;
+    heap_init(&heap);
+
+    Obj *small[3];
+    for (int i = 0; i < 3; ++i) {
+        small[i] = heap_allocate(&heap, 40);
+    }
+    Obj *medium = heap_allocate(&heap, 64);
+    Obj *large = heap_allocate(&heap, HEAP_MAX_CELL_SIZE + 1);
+    TEST_ASSERT_EQUAL_UINT(2, heap.page_count);
+    TEST_ASSERT_EQUAL_UINT(3, small[0]->size_class);
+    TEST_ASSERT_EQUAL_UINT(4, medium->size_class);
+    TEST_ASSERT_EQUAL_UINT(0, large->size_class);
+    /* Cells of one class are packed next to each other in the same page. */
+    TEST_ASSERT_TRUE((char *)small[1] == (char *)small[0] + 48);
+    TEST_ASSERT_TRUE((char *)small[2] == (char *)small[1] + 48);
+
+    int visited = 0;
+    for (Obj *object = heap_first(&heap); object; object = heap_next(&heap, object)) {
+        visited++;
+    }
+    TEST_ASSERT_EQUAL_INT(5, visited);
+
+    heap_release(&heap, small[1]);
+    TEST_ASSERT_TRUE(heap_allocate(&heap, 48) == small[1]);
+
+    /* The sweep cursor may release what it returns and drops pages it leaves empty. */
+    int swept = 0;
+    heap_sweep_begin(&heap);
+    for (Obj *object = heap_sweep_next(&heap); object; object = heap_sweep_next(&heap)) {
+        if (object != medium) {
+            heap_release(&heap, object);
+        }
+        swept++;
+    }
+    TEST_ASSERT_EQUAL_INT(5, swept);
+    TEST_ASSERT_EQUAL_UINT(1, heap.page_count);
+    TEST_ASSERT_TRUE(heap_first(&heap) == medium);
+    TEST_ASSERT_NULL(heap_next(&heap, medium));
+
+    heap_free(&heap);
+}
+
+void test_vm_strings_store_characters_inline(void) {
+    VM vm;
+    vm_init(&vm);
+    vm_configure_gc(&vm, 2.0, SIZE_MAX);
+    vm_configure_nursery(&vm, 0);
+
+    ObjString *hello = obj_string_copy(&vm, "hello, ", 7);
+    ObjString *world = obj_string_copy(&vm, "world", 5);
+    /* The characters share the header's cell. */
+    TEST_ASSERT_TRUE(hello->chars + hello->length < (char *)hello + hello->obj.size_class * HEAP_GRANULE);
+
+    ObjString *joined = obj_string_concat(&vm, hello, world);
+    TEST_ASSERT_EQUAL_STRING("hello, world", joined->chars);
+    TEST_ASSERT_TRUE(joined == obj_string_copy(&vm, "hello, world", 12));
+
+    /* Once interned, neither path allocates. */
+    size_t before = vm.bytes_allocated;
+    Obj *young = vm.young_objects;
+    TEST_ASSERT_TRUE(obj_string_concat(&vm, hello, world) == joined);
+    TEST_ASSERT_TRUE(obj_string_copy(&vm, "hello, world", 12) == joined);
+    TEST_ASSERT_EQUAL_UINT(before, vm.bytes_allocated);
+    TEST_ASSERT_TRUE(vm.young_objects == young);
+
+    char long_text[HEAP_MAX_CELL_SIZE * 2];
+    memset(long_text, 'x', sizeof(long_text));
+    ObjString *long_string = obj_string_copy(&vm, long_text, sizeof(long_text));
+    TEST_ASSERT_EQUAL_UINT(0, long_string->obj.size_class);
+    TEST_ASSERT_EQUAL_UINT(sizeof(long_text), strlen(long_string->chars));
+    TEST_ASSERT_EQUAL_UINT(before + sizeof(ObjString) + sizeof(long_text) + 1, vm.bytes_allocated);
+
+    vm_free(&vm);
+}
+
+void test_vm_intern_table_reuses_tombstones(void) {
+    VM vm;
+    vm_init(&vm);
+
+    char buffer[32];
+    Value keep[64];
+    for (int i = 0; i < 64; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "keep-%d", i);
+        keep[i] = value_make_string(obj_string_copy(&vm, buffer, (size_t)length));
+        vm_push(&vm, keep[i]);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "drop-%d", i);
+        obj_string_copy(&vm, buffer, (size_t)length);
+    }
+    size_t capacity = vm.strings.capacity;
+
+    vm_collect_garbage(&vm);
+
+    for (int i = 0; i < 64; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "keep-%d", i);
+        uint32_t hash = hash_bytes(buffer, (size_t)length);
+        TEST_ASSERT_TRUE(table_find_string(&vm.strings, buffer, (size_t)length, hash) == value_as_string(keep[i]));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "drop-%d", i);
+        TEST_ASSERT_NULL(table_find_string(&vm.strings, buffer, (size_t)length, hash_bytes(buffer, (size_t)length)));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        int length = snprintf(buffer, sizeof(buffer), "drop-%d", i);
+        ObjString *string = obj_string_copy(&vm, buffer, (size_t)length);
+        TEST_ASSERT_TRUE(string == obj_string_copy(&vm, buffer, (size_t)length));
+    }
+    TEST_ASSERT_EQUAL_UINT(capacity, vm.strings.capacity);
+
+    for (int i = 0; i < 64; ++i) {
+        vm_pop(&vm);
+    }
+    vm_free(&vm);
+}
+
+void test_vm_value_representation_round_trips(void) {
+    VM vm;
+    vm_init(&vm);
+
+    const double numbers[] = {0.0, -0.0, 1.5, -3.25, 1e300, -1e-300, INFINITY, -INFINITY};
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        Value value = value_make_number(numbers[i]);
+        TEST_ASSERT_TRUE(value_is_number(value));
+        TEST_ASSERT_FALSE(value_is_obj(value));
+        TEST_ASSERT_FALSE(value_is_null(value));
+        TEST_ASSERT_FALSE(value_is_bool(value));
+        TEST_ASSERT_TRUE(memcmp(&numbers[i], &(double){value_as_number(value)}, sizeof(double)) == 0);
+    }
+    Value nan_value = value_make_number(NAN);
+    TEST_ASSERT_TRUE(value_is_number(nan_value));
+    TEST_ASSERT_TRUE(isnan(value_as_number(nan_value)));
+    TEST_ASSERT_FALSE(value_equals(nan_value, nan_value));
+
+    Value null_value = value_make_null();
+    Value true_value = value_make_bool(true);
+    Value false_value = value_make_bool(false);
+    TEST_ASSERT_TRUE(value_is_null(null_value));
+    TEST_ASSERT_FALSE(value_is_bool(null_value));
+    TEST_ASSERT_TRUE(value_is_bool(true_value) && value_as_bool(true_value));
+    TEST_ASSERT_TRUE(value_is_bool(false_value) && !value_as_bool(false_value));
+    TEST_ASSERT_FALSE(value_is_number(null_value) || value_is_number(true_value) || value_is_number(false_value));
+    TEST_ASSERT_FALSE(value_is_obj(null_value) || value_is_obj(true_value) || value_is_obj(false_value));
+    TEST_ASSERT_FALSE(value_equals(false_value, null_value));
+    TEST_ASSERT_FALSE(value_equals(value_make_number(0.0), false_value));
+    TEST_ASSERT_TRUE(value_equals(value_make_number(0.0), value_make_number(-0.0)));
+
+    ObjString *string = obj_string_copy(&vm, "boxed", 5);
+    Value string_value = value_make_string(string);
+    TEST_ASSERT_TRUE(value_is_obj(string_value));
+    TEST_ASSERT_TRUE(value_is_string(string_value));
+    TEST_ASSERT_FALSE(value_is_number(string_value));
+    TEST_ASSERT_TRUE(value_as_string(string_value) == string);
+    TEST_ASSERT_TRUE(value_is_truthy(string_value));
+    TEST_ASSERT_TRUE(value_is_truthy(value_make_number(0.0)));
+    TEST_ASSERT_FALSE(value_is_truthy(null_value));
+
+#ifdef VIBELANG_NAN_BOXING
+    TEST_ASSERT_EQUAL_UINT(8, sizeof(Value));
+#endif
+
+    vm_free(&vm);
+}
+
+void test_vm_instances_share_shapes(void) {
+    VM vm;
+    vm_init(&vm);
+
+    ObjString *name = obj_string_copy(&vm, "Point", 5);
+    vm_push(&vm, value_make_string(name));
+    ObjClass *klass = obj_class_new(&vm, name);
+    vm_pop(&vm);
+    vm_push(&vm, value_make_class(klass));
+    ObjString *x = obj_string_copy(&vm, "x", 1);
+    vm_push(&vm, value_make_string(x));
+    ObjString *y = obj_string_copy(&vm, "y", 1);
+    vm_push(&vm, value_make_string(y));
+
+    ObjInstance *first = obj_instance_new(&vm, klass);
+    vm_push(&vm, value_make_instance(first));
+    ObjInstance *second = obj_instance_new(&vm, klass);
+    vm_push(&vm, value_make_instance(second));
+    ObjInstance *swapped = obj_instance_new(&vm, klass);
+    vm_push(&vm, value_make_instance(swapped));
+
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, first, x, value_make_number(1.0)));
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, first, y, value_make_number(2.0)));
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, second, x, value_make_number(3.0)));
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, second, y, value_make_number(4.0)));
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, swapped, y, value_make_number(5.0)));
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, swapped, x, value_make_number(6.0)));
+
+    TEST_ASSERT_TRUE(first->shape == second->shape);
+    TEST_ASSERT_TRUE(first->shape != swapped->shape);
+    TEST_ASSERT_EQUAL_UINT(2, first->shape->slot_count);
+    TEST_ASSERT_EQUAL_INT(0, shape_find_slot(first->shape, x));
+    TEST_ASSERT_EQUAL_INT(1, shape_find_slot(swapped->shape, x));
+    TEST_ASSERT_EQUAL_UINT(2, klass->instance_slot_count);
+
+    TEST_ASSERT_TRUE(obj_instance_set_field(&vm, second, x, value_make_number(7.0)));
+    TEST_ASSERT_TRUE(first->shape == second->shape);
+
+    Value field;
+    TEST_ASSERT_TRUE(obj_instance_get_field(second, x, &field));
+    assert_number_close(7.0, field);
+    TEST_ASSERT_TRUE(obj_instance_get_field(swapped, y, &field));
+    assert_number_close(5.0, field);
+    TEST_ASSERT_FALSE(obj_instance_get_field(first, klass->name, &field));
+
+    ObjInstance *presized = obj_instance_new(&vm, klass);
+    TEST_ASSERT_TRUE(presized->slot_capacity >= 2);
+    TEST_ASSERT_TRUE(presized->shape == vm.root_shape);
+
+    for (int i = 0; i < 6; ++i) {
+        vm_pop(&vm);
+    }
+    vm_free(&vm);
+}
+
+void test_vm_well_known_names_and_constructor_slot(void) {
+    VM vm;
+    vm_init(&vm);
+
+    ObjString *constructor_name = vm.names[VM_NAME_CONSTRUCTOR];
+    TEST_ASSERT_NOT_NULL(constructor_name);
+    vm_collect_garbage(&vm);
+    TEST_ASSERT_TRUE(obj_string_copy(&vm, "constructor", 11) == constructor_name);
+
+    ObjString *name = obj_string_copy(&vm, "Player", 6);
+    vm_push(&vm, value_make_string(name));
+    ObjClass *klass = obj_class_new(&vm, name);
+    vm_pop(&vm);
+    vm_push(&vm, value_make_class(klass));
+    ObjFunction *walk = obj_function_new(&vm, "walk", 1);
+    vm_push(&vm, value_make_function(walk));
+    ObjFunction *init = obj_function_new(&vm, "constructor", 1);
+    vm_push(&vm, value_make_function(init));
+
+    TEST_ASSERT_NULL(klass->constructor);
+    TEST_ASSERT_TRUE(obj_class_define_method(&vm, klass, walk->name, value_make_function(walk)));
+    TEST_ASSERT_NULL(klass->constructor);
+    TEST_ASSERT_TRUE(obj_class_define_method(&vm, klass, init->name, value_make_function(init)));
+    TEST_ASSERT_TRUE(klass->constructor == init);
+
+    vm_pop(&vm);
+    vm_pop(&vm);
+    vm_pop(&vm);
+    vm_free(&vm);
+}
+
+void test_vm_chunk_lines_are_run_length_encoded(void) {
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    const int lines[] = {1, 1, 1, 2, 2, 5};
+    for (int i = 0; i < 6; i++) {
+        chunk_write(&chunk, OP_LOAD_NULL, lines[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(3, chunk.line_count);
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL_INT(lines[i], chunk_get_line(&chunk, i));
+    }
+
+    chunk_free(&chunk);
+}
+
+void test_vm_chunk_deduplicates_constants(void) {
+    VM vm;
+    vm_init(&vm);
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    Value name = make_string_value(&vm, "x");
+    vm_push(&vm, name);
+    uint16_t first_number = chunk_add_constant(&chunk, value_make_number(1.5));
+    uint16_t first_name = chunk_add_constant(&chunk, name);
+    TEST_ASSERT_EQUAL_UINT(first_number, chunk_add_constant(&chunk, value_make_number(1.5)));
+    TEST_ASSERT_EQUAL_UINT(first_name, chunk_add_constant(&chunk, make_string_value(&vm, "x")));
+    TEST_ASSERT_TRUE(chunk_add_constant(&chunk, value_make_number(0.0)) !=
+                     chunk_add_constant(&chunk, value_make_number(-0.0)));
+    TEST_ASSERT_EQUAL_INT(4, (int)chunk.constants.count);
+
+    for (int i = 0; i < 1000; i++) {
+        chunk_add_constant(&chunk, value_make_number((double)i));
+        chunk_add_constant(&chunk, value_make_number((double)i));
+    }
+    TEST_ASSERT_EQUAL_INT(1003, (int)chunk.constants.count);
+    TEST_ASSERT_EQUAL_UINT(first_name, chunk_add_constant(&chunk, name));
+
+    ObjFunction *function = obj_function_new(&vm, "f", 0);
+    vm_push(&vm, value_make_function(function));
+    TEST_ASSERT_TRUE(chunk_add_constant(&chunk, value_make_function(function)) !=
+                     chunk_add_constant(&chunk, value_make_function(function)));
+
+    chunk_free(&chunk);
+    vm_pop(&vm);
+    vm_pop(&vm);
+    vm_free(&vm);
+}
+
+void test_vm_quickens_and_dequickens_binary_ops(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = obj_function_new(&vm, "main", 0);
+    Chunk *chunk = &function->chunk;
+
+    int left_offset = chunk->count;
+    write_load_const(chunk, 0, value_make_number(1.0), 1);
+    int right_offset = chunk->count;
+    write_load_const(chunk, 1, value_make_number(2.0), 1);
+    int equal_offset = chunk->count;
+    write_binary(chunk, OP_EQUAL, 2, 0, 1, 1);
+    int add_offset = chunk->count;
+    write_binary(chunk, OP_ADD, 0, 0, 1, 1);
+    write_return(chunk, 0, 1);
+    ensure_register_count(function, 3);
+
+    Value result = value_make_null();
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    assert_number_close(3.0, result);
+    TEST_ASSERT_EQUAL_INT(OP_EQUAL_NUM, chunk->code[equal_offset]);
+    TEST_ASSERT_EQUAL_INT(OP_ADD_NUM, chunk->code[add_offset]);
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    assert_number_close(3.0, result);
+
+    vm_push(&vm, value_make_function(function));
+    patch_load_index(chunk, left_offset, obj_function_add_constant(&vm, function, make_string_value(&vm, "a")));
+    patch_load_index(chunk, right_offset, obj_function_add_constant(&vm, function, make_string_value(&vm, "b")));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    assert_string_equal("ab", result);
+    TEST_ASSERT_EQUAL_INT(OP_EQUAL, chunk->code[equal_offset]);
+    TEST_ASSERT_EQUAL_INT(OP_ADD, chunk->code[add_offset]);
+
+    vm_free(&vm);
+}
+
+void test_vm_append_quickens_numbers_and_extends_arrays_in_place(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = obj_function_new(&vm, "main", 0);
+    Chunk *chunk = &function->chunk;
+
+    int left_offset = chunk->count;
+    write_load_const(chunk, 0, value_make_number(1.0), 1);
+    write_load_const(chunk, 1, value_make_number(2.0), 1);
+    int append_offset = chunk->count;
+    write_binary(chunk, OP_APPEND, 0, 0, 1, 1);
+    write_return(chunk, 0, 1);
+    ensure_register_count(function, 2);
+
+    Value result = value_make_null();
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    assert_number_close(3.0, result);
+    TEST_ASSERT_EQUAL_INT(OP_APPEND_NUM, chunk->code[append_offset]);
+
+    vm_push(&vm, value_make_function(function));
+    Value elements[] = {value_make_number(1.0)};
+    ObjArray *array = obj_array_copy(&vm, elements, 1);
+    patch_load_index(chunk, left_offset, obj_function_add_constant(&vm, function, value_make_array(array)));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    TEST_ASSERT_TRUE(value_is_array(result) && value_as_array(result) == array);
+    TEST_ASSERT_EQUAL_UINT(2, array->elements.count);
+    TEST_ASSERT_EQUAL_INT(OP_APPEND, chunk->code[append_offset]);
+
+    vm_free(&vm);
+}
+
+void test_vm_peephole_cleans_up_chunk(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = obj_function_new(&vm, "main", 0);
+    Chunk *chunk = &function->chunk;
+
+    write_load_bool(chunk, 0, true, 1);
+    write_unary(chunk, OP_MOVE, 0, 0, 1);
+    write_unary(chunk, OP_MOVE, 1, 0, 1);
+    write_unary(chunk, OP_NOT, 1, 0, 2);
+    int else_jump = write_jump_if_false(chunk, 1, 2);
+    write_load_const(chunk, 2, value_make_number(1.0), 3);
+    int then_jump = write_jump(chunk, 3);
+    patch_jump(chunk, else_jump);
+    write_load_const(chunk, 2, value_make_number(2.0), 4);
+    int join = chunk->count;
+    int join_jump = write_jump(chunk, 4);
+    patch_jump(chunk, join_jump);
+    write_return(chunk, 2, 5);
+    write_load_null(chunk, 3, 6);
+    write_return(chunk, 3, 6);
+    chunk->code[then_jump] = 0;
+    chunk->code[then_jump + 1] = (uint8_t)(join - (then_jump + 2));
+    ensure_register_count(function, 4);
+
+    PeepholeStats stats;
+    peephole_optimize(chunk, &stats);
+    TEST_ASSERT_EQUAL_INT(12, stats.instructions_before);
+    TEST_ASSERT_EQUAL_INT(6, stats.instructions_after);
+
+    /* The chain through both JUMPs ends at a RETURN, which is copied in place. */
+    const uint8_t expected[] = {OP_LOAD_TRUE, 0, OP_JUMP_IF_TRUE, 0, 0, 6, OP_LOAD_CONST, 2, 0, 0,
+                                OP_RETURN, 2, OP_LOAD_CONST, 2, 0, 1, OP_RETURN, 2};
+    TEST_ASSERT_EQUAL_INT((int)sizeof(expected), chunk->count);
+    for (size_t i = 0; i < sizeof(expected); i++) {
+        TEST_ASSERT_EQUAL_UINT(expected[i], chunk->code[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(2, chunk_get_line(chunk, 2));
+    TEST_ASSERT_EQUAL_INT(4, chunk_get_line(chunk, 12));
+
+    Value result = value_make_null();
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret(&vm, function, &result));
+    assert_number_close(2.0, result);
+
+    vm_free(&vm);
+}
+
+void test_vm_peephole_verify_rejects_out_of_range_operands(void) {
+    VM vm;
+    vm_init(&vm);
+    ObjFunction *function = obj_function_new(&vm, "main", 0);
+    Chunk *chunk = &function->chunk;
+
+    int jump = write_jump(chunk, 1);
+    patch_jump(chunk, jump);
+    write_load_const(chunk, 1, value_make_number(1.0), 2);
+    int property = chunk->count;
+    chunk_write(chunk, OP_GET_PROPERTY, 3);
+    chunk_write(chunk, 0, 3);
+    chunk_write(chunk, 1, 3);
+    chunk_write(chunk, 0, 3);
+    chunk_write(chunk, (uint8_t)obj_function_add_constant(&vm, function, make_string_value(&vm, "field")), 3);
+    chunk_write(chunk, 0, 3);
+    chunk_write(chunk, 0, 3);
+    write_return(chunk, 0, 4);
+
+    /* No inline cache has been allocated for the property access yet. */
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 2));
+    chunk_add_inline_cache(chunk);
+    TEST_ASSERT_TRUE(peephole_verify(chunk, 2));
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 1));
+
+    chunk->code[property + 4] = 0;
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 2));
+    chunk->code[property + 4] = 1;
+    chunk->code[6] = 9;
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 2));
+    chunk->code[6] = 0;
+    chunk->code[jump + 1] = 1;
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 2));
+    chunk->code[jump + 1] = 0;
+    TEST_ASSERT_TRUE(peephole_verify(chunk, 2));
+
+    /* Without the RETURN, execution would run off the end of the code. */
+    chunk->count -= 2;
+    TEST_ASSERT_FALSE(peephole_verify(chunk, 2));
+
+    vm_free(&vm);
+}